@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2022 Lefucjusz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../tarchivist.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#define HEADERS_COUNT (1000 * 1000)
+#define BLOCK_SIZE TARCHIVIST_TAR_BLOCK_SIZE
+
+typedef struct mem_stream_t {
+    uint8_t *data;
+    size_t size;
+    size_t pos;
+} mem_stream_t;
+
+/* Memory stream callbacks */
+static int mem_seek(tarchivist_t *tar, int64_t offset, int whence) {
+    mem_stream_t *mem = tar->stream;
+    const int64_t pos = (whence == TARCHIVIST_SEEK_END) ? (int64_t)mem->size + offset : offset;
+    if (pos < 0 || (size_t)pos > mem->size) {
+        return TARCHIVIST_SEEKFAIL;
+    }
+    mem->pos = pos;
+    return TARCHIVIST_SUCCESS;
+}
+
+static int64_t mem_tell(tarchivist_t *tar) {
+    const mem_stream_t *mem = tar->stream;
+    return mem->pos;
+}
+
+static int mem_read(tarchivist_t *tar, unsigned size, void *data) {
+    mem_stream_t *mem = tar->stream;
+    if (mem->size - mem->pos < size) {
+        return TARCHIVIST_READFAIL;
+    }
+    memcpy(data, mem->data + mem->pos, size);
+    mem->pos += size;
+    return TARCHIVIST_SUCCESS;
+}
+
+static int mem_write(tarchivist_t *tar, unsigned size, const void *data) {
+    mem_stream_t *mem = tar->stream;
+    if (mem->size - mem->pos < size) {
+        return TARCHIVIST_WRITEFAIL;
+    }
+    memcpy(mem->data + mem->pos, data, size);
+    mem->pos += size;
+    return TARCHIVIST_SUCCESS;
+}
+
+static int mem_close(tarchivist_t *tar) {
+    (void)tar;
+    return TARCHIVIST_SUCCESS;
+}
+
+static void mem_tar_init(tarchivist_t *tar, mem_stream_t *mem) {
+    memset(tar, 0, sizeof(tarchivist_t));
+    tar->seek = mem_seek;
+    tar->tell = mem_tell;
+    tar->read = mem_read;
+    tar->write = mem_write;
+    tar->close = mem_close;
+    tar->stream = mem;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Header decoding as it was done before - sscanf and byte-wise checksum */
+static int legacy_decode(tarchivist_header_t *header, const uint8_t *raw) {
+    unsigned checksum = 0, stored_checksum, size;
+    unsigned i;
+
+    for (i = 0; i < BLOCK_SIZE; ++i) {
+        if (i >= 148 && i < 156) {
+            checksum += (unsigned)(' ');
+        }
+        else {
+            checksum += raw[i];
+        }
+    }
+    sscanf((const char *)raw + 148, "%o", &stored_checksum);
+    if (checksum != stored_checksum) {
+        return TARCHIVIST_BADCHKSUM;
+    }
+
+    memcpy(header->name, raw, sizeof(header->name));
+    sscanf((const char *)raw + 100, "%o", &header->mode);
+    sscanf((const char *)raw + 108, "%o", &header->uid);
+    sscanf((const char *)raw + 116, "%o", &header->gid);
+    sscanf((const char *)raw + 124, "%o", &size);
+    header->size = size;
+    sscanf((const char *)raw + 136, "%o", &header->mtime);
+    header->typeflag = raw[156];
+    memcpy(header->linkname, raw + 157, sizeof(header->linkname));
+    memcpy(header->uname, raw + 265, sizeof(header->uname));
+    memcpy(header->gname, raw + 297, sizeof(header->gname));
+    sscanf((const char *)raw + 329, "%o", &header->devmajor);
+    sscanf((const char *)raw + 337, "%o", &header->devminor);
+    memcpy(header->prefix, raw + 345, sizeof(header->prefix));
+
+    return TARCHIVIST_SUCCESS;
+}
+
+static int generate(tarchivist_t *tar) {
+    tarchivist_header_t header = {0};
+    unsigned i;
+    int err;
+
+    header.mode = 0644;
+    header.uid = 1000;
+    header.gid = 1000;
+    header.mtime = time(NULL);
+    header.typeflag = TARCHIVIST_FILE;
+    snprintf(header.uname, sizeof(header.uname), "Lefucjusz");
+    snprintf(header.gname, sizeof(header.gname), "Lefucjusz");
+
+    for (i = 0; i < HEADERS_COUNT; ++i) {
+        snprintf(header.name, sizeof(header.name), "some_directory/file_%07u.txt", i);
+        header.size = 0;
+        err = tarchivist_write_header(tar, &header);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+    }
+    return TARCHIVIST_SUCCESS;
+}
+
+int main(void) {
+    tarchivist_t tar;
+    tarchivist_header_t header;
+    mem_stream_t mem;
+    unsigned long long checksum = 0;
+    double start, legacy_time, current_time;
+    unsigned i;
+    int err;
+
+    printf("bench-header-decode - header decoding throughput\n");
+    printf("(c) Lefucjusz 2022\n\n");
+
+    mem.size = (size_t)HEADERS_COUNT * BLOCK_SIZE;
+    mem.pos = 0;
+    mem.data = malloc(mem.size);
+    if (mem.data == NULL) {
+        printf("Error: failed to allocate %zuB for headers buffer!\n", mem.size);
+        return 1;
+    }
+
+    do
+    {
+        printf("Generating %u headers...\n", HEADERS_COUNT);
+        mem_tar_init(&tar, &mem);
+        err = generate(&tar);
+        if (err != TARCHIVIST_SUCCESS) {
+            printf("Error: failed to generate headers, error: %s!\n", tarchivist_strerror(err));
+            break;
+        }
+
+        /* Before: sscanf and byte-wise checksum */
+        start = now();
+        for (i = 0; i < HEADERS_COUNT; ++i) {
+            err = legacy_decode(&header, mem.data + (size_t)i * BLOCK_SIZE);
+            if (err != TARCHIVIST_SUCCESS) {
+                break;
+            }
+            checksum += header.mtime + header.mode;
+        }
+        legacy_time = now() - start;
+        if (err != TARCHIVIST_SUCCESS) {
+            printf("Error: legacy decoder failed, error: %s!\n", tarchivist_strerror(err));
+            break;
+        }
+
+        /* After: library decoder */
+        start = now();
+        for (i = 0; i < HEADERS_COUNT; ++i) {
+            mem.pos = (size_t)i * BLOCK_SIZE;
+            err = tarchivist_read_header(&tar, &header);
+            if (err != TARCHIVIST_SUCCESS) {
+                break;
+            }
+            checksum -= header.mtime + header.mode;
+        }
+        current_time = now() - start;
+        if (err != TARCHIVIST_SUCCESS) {
+            printf("Error: library decoder failed, error: %s!\n", tarchivist_strerror(err));
+            break;
+        }
+
+        printf("sscanf decoder:  %10.0f headers/s\n", HEADERS_COUNT / legacy_time);
+        printf("library decoder: %10.0f headers/s\n", HEADERS_COUNT / current_time);
+        printf("Speedup: %.2fx%s\n", legacy_time / current_time, (checksum != 0) ? " (results differ!)" : "");
+
+    } while (0);
+
+    free(mem.data);
+    return 0;
+}
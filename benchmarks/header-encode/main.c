@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2022 Lefucjusz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../tarchivist.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#define FILES_COUNT (1000 * 1000)
+#define FILE_SIZE 100
+#define BLOCK_SIZE TARCHIVIST_TAR_BLOCK_SIZE
+
+/* Sink stream callbacks - data is discarded, only the position is tracked */
+static int sink_seek(tarchivist_t *tar, int64_t offset, int whence) {
+    if (whence != TARCHIVIST_SEEK_SET) {
+        return TARCHIVIST_SEEKFAIL;
+    }
+    *(int64_t *)tar->stream = offset;
+    return TARCHIVIST_SUCCESS;
+}
+
+static int64_t sink_tell(tarchivist_t *tar) {
+    return *(int64_t *)tar->stream;
+}
+
+static int sink_read(tarchivist_t *tar, unsigned size, void *data) {
+    (void)tar;
+    (void)size;
+    (void)data;
+    return TARCHIVIST_READFAIL;
+}
+
+static int sink_write(tarchivist_t *tar, unsigned size, const void *data) {
+    (void)data;
+    *(int64_t *)tar->stream += size;
+    return TARCHIVIST_SUCCESS;
+}
+
+static int sink_close(tarchivist_t *tar) {
+    (void)tar;
+    return TARCHIVIST_SUCCESS;
+}
+
+static void sink_tar_init(tarchivist_t *tar, int64_t *pos) {
+    memset(tar, 0, sizeof(tarchivist_t));
+    tar->seek = sink_seek;
+    tar->tell = sink_tell;
+    tar->read = sink_read;
+    tar->write = sink_write;
+    tar->close = sink_close;
+    *pos = 0;
+    tar->stream = pos;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Header encoding as it was done before - memset, sprintf and full checksum */
+static void legacy_encode(char *raw, const tarchivist_header_t *header) {
+    unsigned checksum = 0;
+    unsigned i;
+
+    memset(raw, 0, BLOCK_SIZE);
+    memcpy(raw, header->name, sizeof(header->name));
+    sprintf(raw + 100, "%o", header->mode);
+    sprintf(raw + 108, "%o", header->uid);
+    sprintf(raw + 116, "%o", header->gid);
+    sprintf(raw + 124, "%o", (unsigned)header->size);
+    sprintf(raw + 136, "%o", header->mtime);
+    raw[156] = header->typeflag;
+    memcpy(raw + 157, header->linkname, sizeof(header->linkname));
+    memcpy(raw + 257, "ustar", 6);
+    memcpy(raw + 263, "00", 2);
+    memcpy(raw + 265, header->uname, sizeof(header->uname));
+    memcpy(raw + 297, header->gname, sizeof(header->gname));
+    sprintf(raw + 329, "%o", header->devmajor);
+    sprintf(raw + 337, "%o", header->devminor);
+    memcpy(raw + 345, header->prefix, sizeof(header->prefix));
+
+    for (i = 0; i < BLOCK_SIZE; ++i) {
+        if (i >= 148 && i < 156) {
+            checksum += (unsigned)(' ');
+        }
+        else {
+            checksum += (uint8_t)raw[i];
+        }
+    }
+    sprintf(raw + 148, "%06o", checksum);
+    raw[155] = ' ';
+}
+
+static void prepare_header(tarchivist_header_t *header) {
+    memset(header, 0, sizeof(tarchivist_header_t));
+    header->mode = 0644;
+    header->uid = 1000;
+    header->gid = 1000;
+    header->size = FILE_SIZE;
+    header->mtime = time(NULL);
+    header->typeflag = TARCHIVIST_FILE;
+    snprintf(header->uname, sizeof(header->uname), "Lefucjusz");
+    snprintf(header->gname, sizeof(header->gname), "Lefucjusz");
+}
+
+int main(void) {
+    static const char data[FILE_SIZE];
+    tarchivist_t tar;
+    tarchivist_header_t header;
+    tarchivist_template_t tpl;
+    char raw[BLOCK_SIZE];
+    int64_t pos;
+    double start, legacy_time, header_time, template_time;
+    unsigned i;
+    long ret = TARCHIVIST_SUCCESS;
+
+    printf("bench-header-encode - small files writing throughput\n");
+    printf("(c) Lefucjusz 2022\n\n");
+    printf("Writing %u files of %uB each to a sink stream...\n", FILES_COUNT, FILE_SIZE);
+
+    /* Before: sprintf encoder */
+    sink_tar_init(&tar, &pos);
+    prepare_header(&header);
+    start = now();
+    for (i = 0; i < FILES_COUNT && ret >= 0; ++i) {
+        snprintf(header.name, sizeof(header.name), "some_directory/file_%07u.txt", i);
+        legacy_encode(raw, &header);
+        tar.write(&tar, sizeof(raw), raw);
+        tar.bytes_left = FILE_SIZE;
+        ret = tarchivist_write_data(&tar, FILE_SIZE, data);
+    }
+    legacy_time = now() - start;
+
+    /* After: tarchivist_write_header */
+    sink_tar_init(&tar, &pos);
+    start = now();
+    for (i = 0; i < FILES_COUNT && ret >= 0; ++i) {
+        snprintf(header.name, sizeof(header.name), "some_directory/file_%07u.txt", i);
+        ret = tarchivist_write_header(&tar, &header);
+        if (ret == TARCHIVIST_SUCCESS) {
+            ret = tarchivist_write_data(&tar, FILE_SIZE, data);
+        }
+    }
+    header_time = now() - start;
+
+    /* After: template header */
+    sink_tar_init(&tar, &pos);
+    tarchivist_template_init(&tpl, &header);
+    start = now();
+    for (i = 0; i < FILES_COUNT && ret >= 0; ++i) {
+        snprintf(header.name, sizeof(header.name), "some_directory/file_%07u.txt", i);
+        ret = tarchivist_write_header_template(&tar, &tpl, header.name, FILE_SIZE, header.mtime);
+        if (ret == TARCHIVIST_SUCCESS) {
+            ret = tarchivist_write_data(&tar, FILE_SIZE, data);
+        }
+    }
+    template_time = now() - start;
+
+    if (ret < 0) {
+        printf("Error: failed to write, error: %s!\n", tarchivist_strerror(ret));
+        return 1;
+    }
+
+    printf("sprintf encoder: %10.0f files/s\n", FILES_COUNT / legacy_time);
+    printf("write_header:    %10.0f files/s\n", FILES_COUNT / header_time);
+    printf("template header: %10.0f files/s\n", FILES_COUNT / template_time);
+    return 0;
+}
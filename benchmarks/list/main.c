@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2022 Lefucjusz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../tarchivist.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#define MEMBERS_COUNT (1000 * 1000)
+#define BLOCK_SIZE TARCHIVIST_TAR_BLOCK_SIZE
+
+typedef struct mem_stream_t {
+    uint8_t *data;
+    size_t size;
+    size_t pos;
+} mem_stream_t;
+
+/* Memory stream callbacks */
+static int mem_seek(tarchivist_t *tar, int64_t offset, int whence) {
+    mem_stream_t *mem = tar->stream;
+    const int64_t pos = (whence == TARCHIVIST_SEEK_END) ? (int64_t)mem->size + offset : offset;
+    if (pos < 0 || (size_t)pos > mem->size) {
+        return TARCHIVIST_SEEKFAIL;
+    }
+    mem->pos = pos;
+    return TARCHIVIST_SUCCESS;
+}
+
+static int64_t mem_tell(tarchivist_t *tar) {
+    const mem_stream_t *mem = tar->stream;
+    return mem->pos;
+}
+
+static int mem_read(tarchivist_t *tar, unsigned size, void *data) {
+    mem_stream_t *mem = tar->stream;
+    if (mem->size - mem->pos < size) {
+        return TARCHIVIST_READFAIL;
+    }
+    memcpy(data, mem->data + mem->pos, size);
+    mem->pos += size;
+    return TARCHIVIST_SUCCESS;
+}
+
+static int mem_write(tarchivist_t *tar, unsigned size, const void *data) {
+    mem_stream_t *mem = tar->stream;
+    if (mem->size - mem->pos < size) {
+        return TARCHIVIST_WRITEFAIL;
+    }
+    memcpy(mem->data + mem->pos, data, size);
+    mem->pos += size;
+    return TARCHIVIST_SUCCESS;
+}
+
+static int mem_close(tarchivist_t *tar) {
+    (void)tar;
+    return TARCHIVIST_SUCCESS;
+}
+
+static void mem_tar_init(tarchivist_t *tar, mem_stream_t *mem) {
+    memset(tar, 0, sizeof(tarchivist_t));
+    tar->seek = mem_seek;
+    tar->tell = mem_tell;
+    tar->read = mem_read;
+    tar->write = mem_write;
+    tar->close = mem_close;
+    tar->stream = mem;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int generate(tarchivist_t *tar) {
+    tarchivist_header_t header = {0};
+    unsigned i;
+    int err;
+
+    header.mode = 0644;
+    header.mtime = time(NULL);
+    header.typeflag = TARCHIVIST_FILE;
+
+    for (i = 0; i < MEMBERS_COUNT; ++i) {
+        snprintf(header.name, sizeof(header.name), "some_directory/file_%07u.txt", i);
+        header.size = 0;
+        err = tarchivist_write_header(tar, &header);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+    }
+    return TARCHIVIST_SUCCESS;
+}
+
+/* Listing as it has to be done with the iterator - whole headers collected in an array */
+static int list_headers(tarchivist_t *tar, tarchivist_header_t **headers, unsigned *count) {
+    tarchivist_iter_t iter;
+    unsigned capacity = 0;
+    tarchivist_header_t *grown;
+    int err;
+
+    *headers = NULL;
+    *count = 0;
+
+    err = tarchivist_iter_init(tar, &iter);
+    while (err == TARCHIVIST_SUCCESS) {
+        if (*count == capacity) {
+            capacity = (capacity > 0) ? (2 * capacity) : 1024;
+            grown = realloc(*headers, capacity * sizeof(tarchivist_header_t));
+            if (grown == NULL) {
+                return TARCHIVIST_NOMEMORY;
+            }
+            *headers = grown;
+        }
+        err = tarchivist_iter_next(&iter, &(*headers)[*count]);
+        if (err == TARCHIVIST_SUCCESS) {
+            (*count)++;
+        }
+    }
+
+    return (err == TARCHIVIST_NULLRECORD) ? TARCHIVIST_SUCCESS : err;
+}
+
+int main(void) {
+    tarchivist_t tar;
+    tarchivist_header_t *headers = NULL;
+    tarchivist_list_t list = {0};
+    mem_stream_t mem;
+    unsigned count = 0;
+    size_t headers_memory, list_memory;
+    double start, headers_time, list_time;
+    int err;
+
+    printf("bench-list - listing an archive of many members\n");
+    printf("(c) Lefucjusz 2022\n\n");
+
+    mem.size = ((size_t)MEMBERS_COUNT + 2) * BLOCK_SIZE;
+    mem.pos = 0;
+    mem.data = calloc(1, mem.size); /* Closing record is already there */
+    if (mem.data == NULL) {
+        printf("Error: failed to allocate %zuB for archive buffer!\n", mem.size);
+        return 1;
+    }
+
+    do
+    {
+        printf("Generating %u members...\n", MEMBERS_COUNT);
+        mem_tar_init(&tar, &mem);
+        tarchivist_set_buffer(&tar, 0);
+        err = generate(&tar);
+        if (err != TARCHIVIST_SUCCESS) {
+            printf("Error: failed to generate members, error: %s!\n", tarchivist_strerror(err));
+            break;
+        }
+
+        /* Before: full headers from the iterator */
+        start = now();
+        err = list_headers(&tar, &headers, &count);
+        headers_time = now() - start;
+        if (err != TARCHIVIST_SUCCESS || count != MEMBERS_COUNT) {
+            printf("Error: failed to list with the iterator, error: %s!\n", tarchivist_strerror(err));
+            break;
+        }
+        headers_memory = count * sizeof(tarchivist_header_t);
+
+        /* After: compact listing */
+        start = now();
+        err = tarchivist_list_build(&tar, &list);
+        list_time = now() - start;
+        if (err != TARCHIVIST_SUCCESS || list.count != MEMBERS_COUNT) {
+            printf("Error: failed to build the listing, error: %s!\n", tarchivist_strerror(err));
+            break;
+        }
+        list_memory = list.count * (3 * sizeof(int64_t) + sizeof(size_t) + sizeof(unsigned) + sizeof(char)) + list.paths_size;
+
+        printf("Iterator: %8.3fs, %6zuMiB\n", headers_time, headers_memory / (1024 * 1024));
+        printf("Listing:  %8.3fs, %6zuMiB%s\n", list_time, list_memory / (1024 * 1024),
+               (strcmp(tarchivist_list_path(&list, count - 1), headers[count - 1].name) != 0) ? " (results differ!)" : "");
+
+    } while (0);
+
+    tarchivist_list_free(&list);
+    free(headers);
+    free(mem.data);
+    return 0;
+}
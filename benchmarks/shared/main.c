@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2022 Lefucjusz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../tarchivist.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#define MEMBERS_COUNT (16 * 1024)
+#define MEMBER_SIZE_MAX (16 * 1024)
+#define PASSES 8
+#define THREADS_MAX 32
+#define ARCHIVE_NAME "bench-shared.tar"
+
+typedef struct worker_t {
+    pthread_t thread;
+    tarchivist_shared_t *shared;
+    unsigned first;
+    unsigned step;
+    unsigned long long bytes;
+    int err;
+} worker_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned member_size(unsigned i) {
+    return (i * 2654435761U) % MEMBER_SIZE_MAX;
+}
+
+static int generate(void) {
+    static char data[MEMBER_SIZE_MAX];
+    tarchivist_t tar;
+    tarchivist_header_t header = {0};
+    unsigned i;
+    long ret;
+    int err;
+
+    err = tarchivist_open(&tar, ARCHIVE_NAME, "w");
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    memset(data, 'x', sizeof(data));
+    header.mode = 0644;
+    header.mtime = time(NULL);
+    header.typeflag = TARCHIVIST_FILE;
+
+    for (i = 0; i < MEMBERS_COUNT; ++i) {
+        snprintf(header.name, sizeof(header.name), "some_directory/file_%07u.txt", i);
+        header.size = member_size(i);
+        err = tarchivist_write_header(&tar, &header);
+        if (err != TARCHIVIST_SUCCESS) {
+            break;
+        }
+        ret = tarchivist_write_data(&tar, (unsigned)header.size, data);
+        if (ret < 0) {
+            err = (int)ret;
+            break;
+        }
+    }
+
+    if (err != TARCHIVIST_SUCCESS) {
+        tarchivist_close(&tar);
+        return err;
+    }
+    return tarchivist_close(&tar);
+}
+
+/* Every worker serves its share of the members through its own readers, like a file server would */
+static void *worker_run(void *arg) {
+    worker_t *worker = arg;
+    tarchivist_reader_t reader;
+    char path[64];
+    char data[4096];
+    unsigned pass, i;
+    long ret;
+
+    for (pass = 0; pass < PASSES; ++pass) {
+        for (i = worker->first; i < MEMBERS_COUNT; i += worker->step) {
+            snprintf(path, sizeof(path), "some_directory/file_%07u.txt", i);
+            worker->err = tarchivist_reader_open(&reader, worker->shared, path);
+            if (worker->err != TARCHIVIST_SUCCESS) {
+                return NULL;
+            }
+            while ((ret = tarchivist_reader_read(&reader, sizeof(data), data)) > 0) {
+                worker->bytes += (unsigned long long)ret;
+            }
+            if (ret < 0) {
+                worker->err = (int)ret;
+                return NULL;
+            }
+        }
+    }
+    return NULL;
+}
+
+static int serve(tarchivist_shared_t *shared, unsigned threads, double *elapsed, unsigned long long *bytes) {
+    worker_t workers[THREADS_MAX];
+    double start;
+    unsigned i, started = 0;
+    int err = TARCHIVIST_SUCCESS;
+
+    *bytes = 0;
+    start = now();
+    for (i = 0; i < threads; ++i) {
+        memset(&workers[i], 0, sizeof(worker_t));
+        workers[i].shared = shared;
+        workers[i].first = i;
+        workers[i].step = threads;
+        if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]) != 0) {
+            err = TARCHIVIST_FAILURE;
+            break;
+        }
+        started++;
+    }
+    for (i = 0; i < started; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        if (workers[i].err != TARCHIVIST_SUCCESS) {
+            err = workers[i].err;
+        }
+        *bytes += workers[i].bytes;
+    }
+    *elapsed = now() - start;
+
+    return err;
+}
+
+static int bench(const char *mode, unsigned threads_max) {
+    tarchivist_shared_t shared;
+    unsigned long long bytes;
+    double elapsed, base = 0.0;
+    unsigned threads;
+    int err;
+
+    err = tarchivist_shared_open(&shared, ARCHIVE_NAME, mode);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    printf("Mode \"%s\":\n", mode);
+    for (threads = 1; threads <= threads_max; threads *= 2) {
+        err = serve(&shared, threads, &elapsed, &bytes);
+        if (err != TARCHIVIST_SUCCESS) {
+            break;
+        }
+        if (threads == 1) {
+            base = elapsed;
+        }
+        printf("%2u threads: %10.0f members/s, %8.1f MiB/s, speedup %5.2fx\n", threads,
+               PASSES * MEMBERS_COUNT / elapsed, bytes / elapsed / (1024.0 * 1024.0), base / elapsed);
+    }
+
+    if (err != TARCHIVIST_SUCCESS) {
+        tarchivist_shared_close(&shared);
+        return err;
+    }
+    return tarchivist_shared_close(&shared);
+}
+
+int main(int argc, char **argv) {
+    unsigned threads_max = THREADS_MAX;
+    int err;
+
+    printf("bench-shared - members served by 1 to N threads from a single shared archive\n");
+    printf("(c) Lefucjusz 2022\n\n");
+
+    if (argc > 1) {
+        threads_max = (unsigned)atoi(argv[1]);
+        if (threads_max == 0 || threads_max > THREADS_MAX) {
+            threads_max = THREADS_MAX;
+        }
+    }
+
+    do
+    {
+        printf("Writing %u members...\n", MEMBERS_COUNT);
+        err = generate();
+        if (err != TARCHIVIST_SUCCESS) {
+            printf("Error: failed to write the archive, error: %s!\n", tarchivist_strerror(err));
+            break;
+        }
+
+        err = bench("r", threads_max);
+        if (err != TARCHIVIST_SUCCESS) {
+            printf("Error: failed to read the archive with pread, error: %s!\n", tarchivist_strerror(err));
+            break;
+        }
+
+        err = bench("rm", threads_max);
+        if (err != TARCHIVIST_SUCCESS) {
+            printf("Error: failed to read the mapped archive, error: %s!\n", tarchivist_strerror(err));
+            break;
+        }
+
+    } while (0);
+
+    remove(ARCHIVE_NAME);
+    return 0;
+}
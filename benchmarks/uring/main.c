@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2022 Lefucjusz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../../tarchivist.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#define MEMBERS_COUNT (100 * 1000)
+#define MEMBER_SIZE_MAX (4 * 1024)
+#define ARCHIVE_NAME "bench-uring.tar"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Sizes vary from member to member, but are the same for both backends */
+static unsigned member_size(unsigned i) {
+    return (i * 2654435761U) % MEMBER_SIZE_MAX;
+}
+
+static int generate(const char *mode, const char *data) {
+    tarchivist_t tar;
+    tarchivist_header_t header = {0};
+    unsigned i;
+    long ret;
+    int err;
+
+    err = tarchivist_open(&tar, ARCHIVE_NAME, mode);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    header.mode = 0644;
+    header.mtime = time(NULL);
+    header.typeflag = TARCHIVIST_FILE;
+
+    for (i = 0; i < MEMBERS_COUNT; ++i) {
+        snprintf(header.name, sizeof(header.name), "some_directory/file_%07u.txt", i);
+        header.size = member_size(i);
+        err = tarchivist_write_header(&tar, &header);
+        if (err != TARCHIVIST_SUCCESS) {
+            break;
+        }
+        ret = tarchivist_write_data(&tar, (unsigned)header.size, data);
+        if (ret < 0) {
+            err = (int)ret;
+            break;
+        }
+    }
+
+    if (err != TARCHIVIST_SUCCESS) {
+        tarchivist_close(&tar);
+        return err;
+    }
+    return tarchivist_close(&tar);
+}
+
+static int extract(const char *mode, char *data, unsigned long long *checksum) {
+    tarchivist_t tar;
+    tarchivist_iter_t iter;
+    tarchivist_header_t header;
+    unsigned count = 0;
+    long ret;
+    int err;
+
+    err = tarchivist_open(&tar, ARCHIVE_NAME, mode);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    err = tarchivist_iter_init(&tar, &iter);
+    while (err == TARCHIVIST_SUCCESS && (err = tarchivist_iter_next(&iter, &header)) == TARCHIVIST_SUCCESS) {
+        ret = tarchivist_iter_read_data(&iter, MEMBER_SIZE_MAX, data);
+        if (ret < 0) {
+            err = (int)ret;
+            break;
+        }
+        *checksum += (unsigned long long)ret + (unsigned char)data[0];
+        count++;
+    }
+
+    tarchivist_close(&tar);
+    if (err != TARCHIVIST_NULLRECORD) {
+        return err;
+    }
+    return (count == MEMBERS_COUNT) ? TARCHIVIST_SUCCESS : TARCHIVIST_FAILURE;
+}
+
+int main(void) {
+    static char data[MEMBER_SIZE_MAX];
+    unsigned long long sync_checksum = 0, uring_checksum = 0;
+    double start, sync_write, uring_write, sync_read, uring_read;
+    int err;
+
+    printf("bench-uring - stdio and io_uring backends on an archive of many small members\n");
+    printf("(c) Lefucjusz 2022\n\n");
+
+    memset(data, 'x', sizeof(data));
+
+    do
+    {
+        printf("Writing %u members...\n", MEMBERS_COUNT);
+        start = now();
+        err = generate("w", data);
+        sync_write = now() - start;
+        if (err != TARCHIVIST_SUCCESS) {
+            printf("Error: failed to write the archive with stdio, error: %s!\n", tarchivist_strerror(err));
+            break;
+        }
+
+        start = now();
+        err = generate("wu", data);
+        uring_write = now() - start;
+        if (err != TARCHIVIST_SUCCESS) {
+            printf("Error: failed to write the archive with io_uring, error: %s!\n", tarchivist_strerror(err));
+            break;
+        }
+
+        printf("Reading %u members...\n", MEMBERS_COUNT);
+        start = now();
+        err = extract("r", data, &sync_checksum);
+        sync_read = now() - start;
+        if (err != TARCHIVIST_SUCCESS) {
+            printf("Error: failed to read the archive with stdio, error: %s!\n", tarchivist_strerror(err));
+            break;
+        }
+
+        start = now();
+        err = extract("ru", data, &uring_checksum);
+        uring_read = now() - start;
+        if (err != TARCHIVIST_SUCCESS) {
+            printf("Error: failed to read the archive with io_uring, error: %s!\n", tarchivist_strerror(err));
+            break;
+        }
+
+        printf("stdio write:    %10.0f members/s\n", MEMBERS_COUNT / sync_write);
+        printf("io_uring write: %10.0f members/s\n", MEMBERS_COUNT / uring_write);
+        printf("stdio read:     %10.0f members/s\n", MEMBERS_COUNT / sync_read);
+        printf("io_uring read:  %10.0f members/s%s\n", MEMBERS_COUNT / uring_read, (sync_checksum != uring_checksum) ? " (results differ!)" : "");
+
+    } while (0);
+
+    remove(ARCHIVE_NAME);
+    return 0;
+}
@@ -31,9 +31,11 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/uio.h>
 
 #define FTW_MAX_DIRS_OPENED 10
 #define STREAM_BUFFER_SIZE (1024 * 1024) // 1MiB
+#define WRITEV_BATCH_SIZE 16
 
 typedef struct tar_ctx_t {
     char *buffer;
@@ -139,6 +141,26 @@ static int packer_pack_file(const struct stat *statbuf, const char *path) {
     printf("Appending file %s to %s (%zu.%03zuKiB)\n", path, path_cleaned, header.size / 1024, header.size % 1024);
     free(path_cleaned);
 
+    /* File fitting the buffer is written along with its header and padding in one go */
+    if (header.size <= ctx.buffer_size) {
+        size_t read_total = 0;
+        while (read_total < header.size) {
+            const ssize_t ret = read(src_file, ctx.buffer + read_total, header.size - read_total);
+            if (ret <= 0) {
+                close(src_file);
+                return PACKER_FAILURE;
+            }
+            read_total += ret;
+        }
+
+        const tarchivist_iovec_t iov = {.data = ctx.buffer, .size = read_total};
+        int err = tarchivist_write_member(&ctx.tar, &header, &iov, 1);
+        if (close(src_file) != 0) {
+            return PACKER_CLOSEFAIL;
+        }
+        return (err == TARCHIVIST_SUCCESS) ? PACKER_SUCCESS : PACKER_LIBERROR;
+    }
+
     int err = tarchivist_write_header(&ctx.tar, &header);
     if (err != TARCHIVIST_SUCCESS) {
         return PACKER_LIBERROR;
@@ -275,7 +297,7 @@ static int packer_unpack_directory(tarchivist_header_t *header, const char *dir)
 }
 
 /* Custom stream callbacks */
-static int custom_seek(tarchivist_t *tar, long offset, int whence) {
+static int custom_seek(tarchivist_t *tar, int64_t offset, int whence) {
     const int fd = *(int*)(tar->stream);
     off_t pos;
     switch (whence) {
@@ -291,7 +313,7 @@ static int custom_seek(tarchivist_t *tar, long offset, int whence) {
     return (pos != -1) ? TARCHIVIST_SUCCESS : TARCHIVIST_SEEKFAIL;
 }
 
-static long custom_tell(tarchivist_t *tar) {
+static int64_t custom_tell(tarchivist_t *tar) {
     const int fd = *(int*)(tar->stream);
     const off_t pos = lseek(fd, 0, SEEK_CUR);
     return (pos != -1) ? pos : TARCHIVIST_SEEKFAIL;
@@ -309,6 +331,46 @@ static int custom_write(tarchivist_t *tar, unsigned size, const void *data) {
     return (ret == size) ? TARCHIVIST_SUCCESS : TARCHIVIST_WRITEFAIL;
 }
 
+static int custom_writev(tarchivist_t *tar, const tarchivist_iovec_t *iov, unsigned iovcnt) {
+    const int fd = *(int*)(tar->stream);
+    struct iovec batch[WRITEV_BATCH_SIZE];
+
+    while (iovcnt > 0) {
+        const unsigned count = (iovcnt < WRITEV_BATCH_SIZE) ? iovcnt : WRITEV_BATCH_SIZE;
+        size_t total = 0;
+        for (unsigned i = 0; i < count; i++) {
+            batch[i].iov_base = (void *)iov[i].data;
+            batch[i].iov_len = iov[i].size;
+            total += iov[i].size;
+        }
+
+        /* Resume after short writes */
+        struct iovec *vec = batch;
+        unsigned vec_count = count;
+        while (total > 0) {
+            ssize_t ret = writev(fd, vec, vec_count);
+            if (ret <= 0) {
+                return TARCHIVIST_WRITEFAIL;
+            }
+            total -= ret;
+            while (vec_count > 0 && (size_t)ret >= vec->iov_len) {
+                ret -= vec->iov_len;
+                vec++;
+                vec_count--;
+            }
+            if (vec_count > 0) {
+                vec->iov_base = (char *)vec->iov_base + ret;
+                vec->iov_len -= ret;
+            }
+        }
+
+        iov += count;
+        iovcnt -= count;
+    }
+
+    return TARCHIVIST_SUCCESS;
+}
+
 static int custom_close(tarchivist_t *tar) {
     const int fd = *(int*)(tar->stream);
     const int err = close(fd);
@@ -330,6 +392,7 @@ static int packer_tar_open(tarchivist_t *tar, const char *filename, const char *
     tar->read = custom_read;
     tar->write = custom_write;
     tar->close = custom_close;
+    tar->writev = custom_writev;
 
     fd_ptr = calloc(1, sizeof(int));
     if (fd_ptr == NULL) {
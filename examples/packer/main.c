@@ -22,10 +22,14 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <getopt.h>
 #include "packer.h"
 
 #define PATH_ERROR 1
+#define JOBS_ERROR 2
+#define OPTION_ERROR 3
+#define DEFAULT_BUDGET_MIB 64
 
 enum {
     PACK,
@@ -33,16 +37,30 @@ enum {
     UNKNOWN
 };
 
+static void print_usage(const char *name) {
+    printf("Usage: %s -p|-u -s source -d destination [-j jobs] [-b budget] [-c]\n", name);
+    printf("  -p         pack the source folder into the destination archive\n");
+    printf("  -u         unpack the source archive into the destination folder, '-' reads it from standard input\n");
+    printf("  -s path    source path\n");
+    printf("  -d path    destination path\n");
+    printf("  -j jobs    number of threads used for packing or unpacking (default: 1)\n");
+    printf("  -b budget  memory budget of the parallel pack in MiB (default: %d)\n", DEFAULT_BUDGET_MIB);
+    printf("  -c         don't leave the processed data in the page cache\n");
+    printf("  -h         print this help\n");
+}
+
 int main(int argc, char **argv) {
     int opt, err = PACKER_SUCCESS;
     int mode = UNKNOWN;
     const char *src_path = NULL;
     const char *dst_path = NULL;
+    unsigned jobs = 1;
+    size_t budget_mib = DEFAULT_BUDGET_MIB;
 
     printf("packer - simple tar-like utility\n");
     printf("(c) Lefucjusz 2022\n\n");
 
-    while ((opt = getopt(argc, argv, "pus:d:")) != -1) {
+    while ((opt = getopt(argc, argv, "pus:d:j:b:ch")) != -1) {
         switch (opt) {
             case 'p':
                 mode = PACK;
@@ -56,6 +74,21 @@ int main(int argc, char **argv) {
             case 'd':
                 dst_path = optarg;
                 break;
+            case 'j':
+                jobs = strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                budget_mib = strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                packer_drop_cache(true);
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return PACKER_SUCCESS;
+            default:
+                print_usage(argv[0]);
+                return OPTION_ERROR;
         }
     }
 
@@ -71,15 +104,20 @@ int main(int argc, char **argv) {
             err = PATH_ERROR;
             break;
         }
+        if (jobs == 0) {
+            printf("Error: number of jobs has to be positive\n");
+            err = JOBS_ERROR;
+            break;
+        }
 
         switch (mode) {
             case PACK:
                 printf("Packing has started...\n");
-                err = packer_pack(dst_path, src_path);
+                err = (jobs > 1) ? packer_pack_parallel(dst_path, src_path, jobs, budget_mib * 1024 * 1024) : packer_pack(dst_path, src_path);
                 break;
             case UNPACK:
                 printf("Unpacking has started...\n");
-                err = packer_unpack(dst_path, src_path);
+                err = (jobs > 1) ? packer_unpack_parallel(dst_path, src_path, jobs) : packer_unpack(dst_path, src_path);
                 break;
             default:
                 printf("Error: no mode option switch provided\n");
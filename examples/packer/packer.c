@@ -20,6 +20,8 @@
  * IN THE SOFTWARE.
  */
 
+#define _GNU_SOURCE // pread, copy_file_range, sync_file_range
+
 #include "packer.h"
 #include "../../tarchivist.h"
 
@@ -29,17 +31,117 @@
 #include <time.h>
 #include <ftw.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <limits.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 #define FTW_MAX_DIRS_OPENED 10
 #define STREAM_BUFFER_SIZE (1024 * 1024) // 1MiB
+#define COPY_CHUNK_SIZE (1024 * 1024 * 1024) // 1GiB, limit of a single in-kernel copy call
+#define PACK_CHUNK_SIZE (1024 * 1024) // 1MiB, multiple of the block size, so that only the last chunk of a file gets padded
+#define STDIN_PATH "-"
+#define CACHE_BATCH_FILES 64
+#define CACHE_BATCH_SIZE (64 * 1024 * 1024) // 64MiB
+#define PATH_ARENA_SIZE (2 * PATH_MAX + 256) // Output directory and the name of a member, with some slack for alignment
+#define PATH_BLOCK_SIZE (16 * PATH_ARENA_SIZE) // Paths of the unpack jobs, allocated a block at a time
+
+/* Extracted files kept open until their data is on the disk and can be dropped from the page cache */
+typedef struct cache_batch_t {
+    int fds[CACHE_BATCH_FILES];
+    size_t count;
+    uint64_t size;
+} cache_batch_t;
 
 typedef struct tar_ctx_t {
     char *buffer;
     size_t buffer_size;
     tarchivist_t tar;
+    cache_batch_t batch;
 } tar_ctx_t;
 
+/* File to be extracted by one of the workers */
+typedef struct unpack_job_t {
+    char *path;
+    int64_t data_offset;
+    uint64_t size;
+} unpack_job_t;
+
+typedef struct unpack_pool_t {
+    unpack_job_t *jobs;
+    size_t jobs_count;
+    size_t jobs_capacity;
+    size_t next_job;
+    tarchivist_arena_t paths; // Paths of the jobs, all kept until the end
+    void *paths_block;        // Block the arena hands out from, chained to the previous ones through its first bytes
+    int archive_fd;
+    int err;
+    pthread_mutex_t lock;
+} unpack_pool_t;
+
+/* Member to be packed, in the order given by ftw */
+typedef struct pack_entry_t {
+    char *path;
+    char *name;
+    char typeflag;
+    uint64_t size;
+    size_t first_chunk;
+    size_t chunks_count;
+    size_t chunks_read; // The reader of the last chunk drops the file from the page cache and closes it
+    int fd;             // Opened by the reader of the first chunk and shared by the readers of the others
+} pack_entry_t;
+
+/* Piece of a file read by one of the readers and waiting for the writer */
+typedef struct pack_chunk_t {
+    size_t entry;
+    char *data;
+    size_t size;
+    bool ready;
+} pack_chunk_t;
+
+typedef struct pack_pool_t {
+    pack_entry_t *entries;
+    size_t entries_count;
+    size_t entries_capacity;
+    pack_chunk_t *chunks;
+    size_t chunks_count;
+    size_t next_chunk;  // Next chunk to be claimed by a reader
+    size_t next_write;  // Next chunk to be written to the archive
+    size_t budget;
+    size_t in_flight;   // Bytes of the chunk buffers claimed by the readers and not written yet
+    char **buffers;     // Chunk buffers given back by the writer, reused by the readers
+    size_t buffers_count;
+    size_t buffers_capacity;
+    int err;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} pack_pool_t;
+
 static tar_ctx_t ctx;
+static pack_pool_t *pack_pool; // ftw() callback takes no user data
+static bool drop_cache;
+static char path_memory[PATH_ARENA_SIZE];
+static tarchivist_arena_t path_arena; // Path of the member being processed, given back right after use
+
+static char *packer_path_alloc(size_t size) {
+    if (path_arena.allocator.alloc == NULL) {
+        tarchivist_arena_init(&path_arena, path_memory, sizeof(path_memory));
+    }
+
+    char *path = path_arena.allocator.alloc(path_arena.allocator.ctx, size);
+    if (path == NULL) {
+        printf("Failed to allocate %zuB for path buffer\n", size);
+    }
+    return path;
+}
+
+static void packer_path_free(char *path, size_t size) {
+    path_arena.allocator.release(path_arena.allocator.ctx, path, size);
+}
 
 static void packer_remove_duplicated_slashes(char *path) {
     if (path == NULL) {
@@ -104,87 +206,225 @@ static int packer_recursive_mkdir(char *path, mode_t mode) {
     return err;
 }
 
+static void packer_fill_header(tarchivist_header_t *header, const char *name, char typeflag, uint64_t size) {
+    time_t timestamp;
+    time(&timestamp);
+
+    snprintf(header->name, sizeof(header->name), "%s", name);
+    header->mode = (typeflag == TARCHIVIST_DIR) ? 0755 : 0644;
+    header->uid = 1000;
+    header->gid = 1000;
+    header->size = size;
+    header->mtime = timestamp;
+    header->typeflag = typeflag;
+    snprintf(header->uname, sizeof(header->uname), "Lefucjusz");
+    snprintf(header->gname, sizeof(header->gname), "Lefucjusz");
+}
+
+/* Tells the system how the file is going to be read, or that its data is no longer needed */
+static void packer_cache_advise(int fd, off_t offset, off_t size, bool done) {
+#ifdef POSIX_FADV_DONTNEED
+    if (drop_cache && size > 0) { // Zero size would mean the whole rest of the file
+        posix_fadvise(fd, offset, size, done ? POSIX_FADV_DONTNEED : POSIX_FADV_SEQUENTIAL);
+    }
+#else
+    (void)fd;
+    (void)offset;
+    (void)size;
+    (void)done;
+#endif
+}
+
+/* Waits for the data of the batched files to reach the disk, drops it from the page cache and closes the files */
+static int packer_cache_flush(cache_batch_t *batch) {
+    int err = PACKER_SUCCESS;
+
+    for (size_t i = 0; i < batch->count; i++) {
+#ifdef __linux__
+        sync_file_range(batch->fds[i], 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
+#ifdef POSIX_FADV_DONTNEED
+        posix_fadvise(batch->fds[i], 0, 0, POSIX_FADV_DONTNEED);
+#endif
+        if (close(batch->fds[i]) != 0) {
+            err = PACKER_CLOSEFAIL;
+        }
+    }
+
+    batch->count = 0;
+    batch->size = 0;
+    return err;
+}
+
+/* Closes the extracted file right away, or, when dropping the cache, starts its writeback and waits for it
+ * only when a whole batch of files has been written, so that the disk is kept busy in the meantime */
+static int packer_close_extracted(cache_batch_t *batch, int fd, uint64_t size) {
+    if (!drop_cache) {
+        return (close(fd) != 0) ? PACKER_CLOSEFAIL : PACKER_SUCCESS;
+    }
+
+#ifdef __linux__
+    sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+    batch->fds[batch->count++] = fd;
+    batch->size += size;
+    if (batch->count == CACHE_BATCH_FILES || batch->size >= CACHE_BATCH_SIZE) {
+        return packer_cache_flush(batch);
+    }
+    return PACKER_SUCCESS;
+}
+
+/* Copies size bytes between the descriptors at the given offsets, keeping the data in the kernel
+ * with copy_file_range or sendfile if possible. Fails if the source ends early, e.g. the file shrank */
+static int packer_copy(int in_fd, off_t in_offset, int out_fd, off_t out_offset, uint64_t size, char *buffer, size_t buffer_size) {
+    uint64_t copied = 0;
+
+#ifdef __linux__
+    while (copied < size) {
+        const size_t chunk_size = (size - copied < COPY_CHUNK_SIZE) ? (size_t)(size - copied) : COPY_CHUNK_SIZE;
+        const ssize_t ret = copy_file_range(in_fd, &in_offset, out_fd, &out_offset, chunk_size, 0);
+        if (ret <= 0) {
+            break; // Not supported between these files, or end of the source
+        }
+        copied += ret;
+    }
+
+    /* sendfile writes at the current offset of the output descriptor */
+    if (copied < size && lseek(out_fd, out_offset, SEEK_SET) == out_offset) {
+        while (copied < size) {
+            const size_t chunk_size = (size - copied < COPY_CHUNK_SIZE) ? (size_t)(size - copied) : COPY_CHUNK_SIZE;
+            const ssize_t ret = sendfile(out_fd, in_fd, &in_offset, chunk_size);
+            if (ret <= 0) {
+                break;
+            }
+            copied += ret;
+            out_offset += ret;
+        }
+    }
+#endif
+
+    /* Buffered fallback */
+    while (copied < size) {
+        const size_t chunk_size = (size - copied < buffer_size) ? (size_t)(size - copied) : buffer_size;
+        ssize_t read_size = pread(in_fd, buffer, chunk_size, in_offset);
+        if (read_size < 0) {
+            return PACKER_FAILURE;
+        }
+        if (read_size == 0) {
+            printf("Source ended before the expected size\n");
+            return PACKER_FAILURE;
+        }
+
+        ssize_t written = 0;
+        while (written < read_size) {
+            const ssize_t ret = pwrite(out_fd, buffer + written, read_size - written, out_offset + written);
+            if (ret < 0) {
+                return PACKER_FAILURE;
+            }
+            written += ret;
+        }
+
+        copied += read_size;
+        in_offset += read_size;
+        out_offset += read_size;
+    }
+
+    return PACKER_SUCCESS;
+}
+
+/* Copies the file data through the user space buffer, for archives with no descriptor to transfer to */
+static int packer_pack_data(int src_fd, uint64_t size) {
+    uint64_t copied = 0;
+    while (copied < size) {
+        const size_t chunk_size = (size - copied < ctx.buffer_size) ? (size_t)(size - copied) : ctx.buffer_size;
+        const ssize_t read_size = read(src_fd, ctx.buffer, chunk_size);
+        if (read_size < 0) {
+            return PACKER_FAILURE;
+        }
+        if (read_size == 0) {
+            printf("Source ended before the expected size\n");
+            return PACKER_FAILURE;
+        }
+
+        if (tarchivist_write_data(&ctx.tar, read_size, ctx.buffer) != read_size) {
+            return PACKER_LIBERROR;
+        }
+        copied += read_size;
+    }
+
+    return PACKER_SUCCESS;
+}
+
 static int packer_pack_file(const struct stat *statbuf, const char *path) {
     tarchivist_header_t header = {0};
 
-    FILE *src_file = fopen(path, "rb");
-    if (src_file == NULL) {
+    const int src_fd = open(path, O_RDONLY);
+    if (src_fd < 0) {
         return PACKER_OPENFAIL;
     }
+    packer_cache_advise(src_fd, 0, statbuf->st_size, false);
 
     const size_t path_length = strlen(path) + 1;
-    char *path_cleaned = calloc(1, path_length);
+    char *path_cleaned = packer_path_alloc(path_length);
     if (path_cleaned == NULL) {
-        printf("Failed to allocate %zuB for path buffer\n", path_length);
+        close(src_fd);
         return PACKER_NOMEMORY;
     }
     snprintf(path_cleaned, path_length, "%s", path);
     packer_path_cleanup(path_cleaned);
 
-    time_t timestamp;
-    time(&timestamp);
-
-    snprintf(header.name, sizeof(header.name), "%s", path_cleaned);
-    header.mode = 0644;
-    header.uid = 1000;
-    header.gid = 1000;
-    header.size = statbuf->st_size;
-    header.mtime = timestamp;
-    header.typeflag = TARCHIVIST_FILE;
-    snprintf(header.uname, sizeof(header.uname), "Lefucjusz");
-    snprintf(header.gname, sizeof(header.gname), "Lefucjusz");
+    packer_fill_header(&header, path_cleaned, TARCHIVIST_FILE, statbuf->st_size);
 
     printf("Appending file %s to %s (%zu.%03zuKiB)\n", path, path_cleaned, header.size / 1024, header.size % 1024);
-    free(path_cleaned);
+    packer_path_free(path_cleaned, path_length);
 
     int err = tarchivist_write_header(&ctx.tar, &header);
     if (err != TARCHIVIST_SUCCESS) {
+        close(src_fd);
         return PACKER_LIBERROR;
     }
 
-    size_t read_size;
-    do
-    {
-        read_size = fread(ctx.buffer, 1, ctx.buffer_size, src_file);
-        err = tarchivist_write_data(&ctx.tar, read_size, ctx.buffer);
-        if (err <= TARCHIVIST_SUCCESS) {
-            return PACKER_LIBERROR;
+    /* Data goes straight to the archive descriptor, the library writes the padding afterwards */
+    int tar_fd;
+    int64_t offset;
+    uint64_t size;
+    err = tarchivist_direct_begin(&ctx.tar, &tar_fd, &offset, &size);
+    if (err == TARCHIVIST_SUCCESS) {
+        err = packer_copy(src_fd, 0, tar_fd, offset, size, ctx.buffer, ctx.buffer_size);
+        if (err != PACKER_SUCCESS || tarchivist_direct_end(&ctx.tar, size) != TARCHIVIST_SUCCESS) {
+            err = PACKER_LIBERROR;
         }
-        
-    } while (ctx.tar.bytes_left > 0);
+    }
+    else if (err == TARCHIVIST_NOTSUPPORTED) {
+        err = packer_pack_data(src_fd, header.size); // Archive with no descriptor to transfer to
+    }
+    else {
+        err = PACKER_LIBERROR;
+    }
 
-    if (fclose(src_file) != 0) {
-        return PACKER_CLOSEFAIL;
+    /* Source file has been read once, it's unlikely to be needed again soon */
+    packer_cache_advise(src_fd, 0, statbuf->st_size, true);
+    if (close(src_fd) != 0 && err == PACKER_SUCCESS) {
+        err = PACKER_CLOSEFAIL;
     }
-    return PACKER_SUCCESS;
+    return err;
 }
 
 static int packer_pack_directory(const char *path) {
     tarchivist_header_t header = {0};
 
     const size_t path_length = strlen(path) + 1;
-    char *path_cleaned = calloc(1, path_length);
+    char *path_cleaned = packer_path_alloc(path_length);
     if (path_cleaned == NULL) {
-        printf("Failed to allocate %zuB for path buffer\n", path_length);
         return PACKER_NOMEMORY;
     }
     snprintf(path_cleaned, path_length, "%s", path);
     packer_path_cleanup(path_cleaned);
 
-    time_t timestamp;
-    time(&timestamp);
-
-    snprintf(header.name, sizeof(header.name), "%s", path_cleaned);
-    header.mode = 0755;
-    header.uid = 1000;
-    header.gid = 1000;
-    header.mtime = timestamp;
-    header.typeflag = TARCHIVIST_DIR;
-    snprintf(header.uname, sizeof(header.uname), "Lefucjusz");
-    snprintf(header.gname, sizeof(header.gname), "Lefucjusz");
+    packer_fill_header(&header, path_cleaned, TARCHIVIST_DIR, 0);
 
     printf("Appending directory %s to %s\n", path, path_cleaned);
-    free(path_cleaned);
+    packer_path_free(path_cleaned, path_length);
 
     if (tarchivist_write_header(&ctx.tar, &header) != TARCHIVIST_SUCCESS) {
         return PACKER_LIBERROR;
@@ -204,51 +444,77 @@ static int packer_ftw_callback(const char *path, const struct stat *statbuf, int
     }
 }
 
+/* Copies the member data through the user space buffer, for archives with no descriptor to transfer from */
+static int packer_unpack_data(int dst_fd) {
+    long read_size;
+    do {
+        read_size = tarchivist_read_data(&ctx.tar, ctx.buffer_size, ctx.buffer);
+        if (read_size < 0) {
+            return PACKER_LIBERROR;
+        }
+
+        ssize_t written = 0;
+        while (written < read_size) {
+            const ssize_t ret = write(dst_fd, ctx.buffer + written, read_size - written);
+            if (ret < 0) {
+                return PACKER_FAILURE;
+            }
+            written += ret;
+        }
+    } while (ctx.tar.bytes_left > 0);
+
+    return PACKER_SUCCESS;
+}
+
 static int packer_unpack_file(tarchivist_header_t *header, const char *dir) {
     const char *name = header->name;
     const size_t path_length = strlen(name) + strlen(dir) + 2; // Two additional for '/' and null-terminator
-    char *full_path = calloc(1, path_length);
+    char *full_path = packer_path_alloc(path_length);
     if (full_path == NULL) {
-        printf("Failed to allocate %zuB for path buffer\n", path_length);
         return PACKER_NOMEMORY;
     }
 
     snprintf(full_path, path_length, "%s/%s", dir, name);
 
-    FILE *dst_file = fopen(full_path, "wb"); // If such file already existed, now it's gone
-    if (dst_file == NULL) {
+    const int dst_fd = open(full_path, O_WRONLY | O_CREAT | O_TRUNC, 0644); // If such file already existed, now it's gone
+    if (dst_fd < 0) {
         printf("Failed to open file %s to write\n", full_path);
-        free(full_path);
+        packer_path_free(full_path, path_length);
         return PACKER_OPENFAIL;
     }
 
     printf("Unpacking file %s (%zu.%03zuKiB)\n", full_path, header->size / 1024, header->size % 1024);
-    free(full_path);
+    packer_path_free(full_path, path_length);
 
-    size_t read_size;
-    do
-    {
-        read_size = tarchivist_read_data(&ctx.tar, ctx.buffer_size, ctx.buffer);
-        if (read_size <= TARCHIVIST_SUCCESS) {
-            fclose(dst_file);
-            return PACKER_LIBERROR;
+    int tar_fd;
+    int64_t offset;
+    uint64_t size;
+    int err = tarchivist_direct_begin(&ctx.tar, &tar_fd, &offset, &size);
+    if (err == TARCHIVIST_SUCCESS) {
+        err = packer_copy(tar_fd, offset, dst_fd, 0, size, ctx.buffer, ctx.buffer_size);
+        if (err != PACKER_SUCCESS || tarchivist_direct_end(&ctx.tar, size) != TARCHIVIST_SUCCESS) {
+            err = PACKER_LIBERROR;
         }
-        fwrite(ctx.buffer, 1, read_size, dst_file);
-
-    } while (ctx.tar.bytes_left > 0);
+    }
+    else if (err == TARCHIVIST_NOTSUPPORTED) {
+        err = packer_unpack_data(dst_fd); // Archive read from a pipe
+    }
+    else {
+        err = PACKER_LIBERROR;
+    }
 
-    if (fclose(dst_file) != 0) {
-        return PACKER_CLOSEFAIL;
+    const int close_err = packer_close_extracted(&ctx.batch, dst_fd, header->size);
+    if (close_err != PACKER_SUCCESS && err == PACKER_SUCCESS) {
+        err = close_err;
     }
-    return PACKER_SUCCESS;
+    return err;
 }
 
 static int packer_unpack_directory(tarchivist_header_t *header, const char *dir) {
     const char *name = header->name;
     const size_t path_length = strlen(name) + strlen(dir) + 2; // Two additional for '/' and null-terminator
-    char *full_path = calloc(1, path_length);
+    char *full_path = packer_path_alloc(path_length);
     if (full_path == NULL) {
-        printf("Failed to allocate %zuB for path buffer\n", path_length);
         return PACKER_NOMEMORY;
     }
 
@@ -263,21 +529,388 @@ static int packer_unpack_directory(tarchivist_header_t *header, const char *dir)
         }
         else {
             printf("Failed to create directory %s\n", full_path);
-            free(full_path);
+            packer_path_free(full_path, path_length);
             return PACKER_FAILURE;
         }
     }
 
-    free(full_path);
+    packer_path_free(full_path, path_length);
     return PACKER_SUCCESS;
 }
 
+static int packer_ftw_collect_callback(const char *path, const struct stat *statbuf, int typeflag) {
+    pack_pool_t *pool = pack_pool;
+
+    if (typeflag != FTW_F && typeflag != FTW_D) {
+        printf("Unhandled case in ftw() callback: %d\n", typeflag);
+        return PACKER_FAILURE;
+    }
+
+    if (pool->entries_count == pool->entries_capacity) {
+        const size_t capacity = (pool->entries_capacity > 0) ? (2 * pool->entries_capacity) : 64;
+        pack_entry_t *entries = realloc(pool->entries, capacity * sizeof(pack_entry_t));
+        if (entries == NULL) {
+            printf("Failed to allocate %zuB for entry list\n", capacity * sizeof(pack_entry_t));
+            return PACKER_NOMEMORY;
+        }
+        pool->entries = entries;
+        pool->entries_capacity = capacity;
+    }
+
+    pack_entry_t *entry = &pool->entries[pool->entries_count];
+    entry->path = strdup(path);
+    entry->name = strdup(path);
+    if (entry->path == NULL || entry->name == NULL) {
+        free(entry->path);
+        free(entry->name);
+        printf("Failed to allocate memory for path buffers\n");
+        return PACKER_NOMEMORY;
+    }
+    packer_path_cleanup(entry->name);
+
+    entry->typeflag = (typeflag == FTW_F) ? TARCHIVIST_FILE : TARCHIVIST_DIR;
+    entry->size = (typeflag == FTW_F) ? (uint64_t)statbuf->st_size : 0;
+    entry->first_chunk = pool->chunks_count;
+    entry->chunks_count = (entry->size + PACK_CHUNK_SIZE - 1) / PACK_CHUNK_SIZE;
+    entry->chunks_read = 0;
+    entry->fd = -1;
+    pool->chunks_count += entry->chunks_count;
+    pool->entries_count++;
+
+    return PACKER_SUCCESS;
+}
+
+static void packer_pool_fail(pack_pool_t *pool, int err) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->err == PACKER_SUCCESS) {
+        pool->err = err;
+    }
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static int packer_read_chunk(pack_pool_t *pool, pack_entry_t *entry, pack_chunk_t *chunk, off_t offset) {
+    if (chunk->data == NULL) {
+        chunk->data = malloc(PACK_CHUNK_SIZE);
+        if (chunk->data == NULL) {
+            printf("Failed to allocate %dB for chunk buffer\n", PACK_CHUNK_SIZE);
+            return PACKER_NOMEMORY;
+        }
+    }
+
+    /* Each file is opened once, by the reader of its first chunk */
+    if (offset == 0) {
+        const int fd = open(entry->path, O_RDONLY);
+        if (fd < 0) {
+            printf("Failed to open file %s to read\n", entry->path);
+            return PACKER_OPENFAIL;
+        }
+        packer_cache_advise(fd, 0, entry->size, false);
+
+        pthread_mutex_lock(&pool->lock);
+        entry->fd = fd;
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    size_t read_total = 0;
+    while (read_total < chunk->size) {
+        const ssize_t ret = pread(entry->fd, chunk->data + read_total, chunk->size - read_total, offset + read_total);
+        if (ret < 0) {
+            return PACKER_FAILURE;
+        }
+        if (ret == 0) {
+            break;
+        }
+        read_total += ret;
+    }
+
+    /* Chunks of a file are read by different readers, the last one drops and closes it */
+    pthread_mutex_lock(&pool->lock);
+    const bool last = (++entry->chunks_read == entry->chunks_count);
+    pthread_mutex_unlock(&pool->lock);
+    if (last) {
+        packer_cache_advise(entry->fd, 0, entry->size, true);
+        if (close(entry->fd) != 0) {
+            return PACKER_CLOSEFAIL;
+        }
+    }
+
+    /* File shrank since it was stat'ed, the member would not match its header */
+    if (read_total < chunk->size) {
+        printf("File %s shrank while being packed\n", entry->path);
+        return PACKER_FAILURE;
+    }
+    return PACKER_SUCCESS;
+}
+
+static void *packer_pack_reader(void *arg) {
+    pack_pool_t *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->err == PACKER_SUCCESS && pool->next_chunk < pool->chunks_count) {
+        const size_t seq = pool->next_chunk++;
+        pack_chunk_t *chunk = &pool->chunks[seq];
+        pack_entry_t *entry = &pool->entries[chunk->entry];
+        const uint64_t offset = (uint64_t)(seq - entry->first_chunk) * PACK_CHUNK_SIZE;
+        chunk->size = (entry->size - offset < PACK_CHUNK_SIZE) ? (size_t)(entry->size - offset) : PACK_CHUNK_SIZE;
+
+        /* The chunk the writer waits for is never held back, otherwise the budget could not be freed;
+         * chunks other than the first one of a file wait until the file is opened */
+        while (pool->err == PACKER_SUCCESS &&
+               ((seq != pool->next_write && pool->in_flight + PACK_CHUNK_SIZE > pool->budget) ||
+                (seq != entry->first_chunk && entry->fd < 0))) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        if (pool->err != PACKER_SUCCESS) {
+            break;
+        }
+        pool->in_flight += PACK_CHUNK_SIZE;
+        if (pool->buffers_count > 0) {
+            chunk->data = pool->buffers[--pool->buffers_count];
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        const int err = packer_read_chunk(pool, entry, chunk, (off_t)offset);
+
+        pthread_mutex_lock(&pool->lock);
+        if (err != PACKER_SUCCESS) {
+            if (pool->err == PACKER_SUCCESS) {
+                pool->err = err;
+            }
+        }
+        chunk->ready = true;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/* Writes the members in the ftw order, taking the file contents from the readers */
+static int packer_pack_writer(pack_pool_t *pool) {
+    tarchivist_header_t header;
+
+    for (size_t i = 0; i < pool->entries_count; i++) {
+        const pack_entry_t *entry = &pool->entries[i];
+
+        memset(&header, 0, sizeof(header));
+        packer_fill_header(&header, entry->name, entry->typeflag, entry->size);
+
+        if (entry->typeflag == TARCHIVIST_DIR) {
+            printf("Appending directory %s to %s\n", entry->path, entry->name);
+        }
+        else {
+            printf("Appending file %s to %s (%zu.%03zuKiB)\n", entry->path, entry->name, (size_t)(entry->size / 1024), (size_t)(entry->size % 1024));
+        }
+
+        if (tarchivist_write_header(&ctx.tar, &header) != TARCHIVIST_SUCCESS) {
+            return PACKER_LIBERROR;
+        }
+
+        for (size_t seq = entry->first_chunk; seq < entry->first_chunk + entry->chunks_count; seq++) {
+            pack_chunk_t *chunk = &pool->chunks[seq];
+
+            pthread_mutex_lock(&pool->lock);
+            while (pool->err == PACKER_SUCCESS && !chunk->ready) {
+                pthread_cond_wait(&pool->cond, &pool->lock);
+            }
+            const int err = pool->err;
+            pthread_mutex_unlock(&pool->lock);
+            if (err != PACKER_SUCCESS) {
+                return err;
+            }
+
+            const long ret = tarchivist_write_data(&ctx.tar, chunk->size, chunk->data);
+            if (ret <= TARCHIVIST_SUCCESS) {
+                return PACKER_LIBERROR;
+            }
+
+            /* Buffer goes back to the readers, the budget limits how many of them there are */
+            pthread_mutex_lock(&pool->lock);
+            if (pool->buffers_count < pool->buffers_capacity) {
+                pool->buffers[pool->buffers_count++] = chunk->data;
+            }
+            else {
+                free(chunk->data);
+            }
+            chunk->data = NULL;
+            pool->in_flight -= PACK_CHUNK_SIZE;
+            pool->next_write++;
+            pthread_cond_broadcast(&pool->cond);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+
+    return PACKER_SUCCESS;
+}
+
+static char *packer_join_path(unpack_pool_t *pool, const char *dir, const char *name) {
+    const size_t path_length = strlen(name) + strlen(dir) + 2; // Two additional for '/' and null-terminator
+    char *full_path = pool->paths.allocator.alloc(pool->paths.allocator.ctx, path_length);
+    if (full_path == NULL) {
+        /* Arena used up, continue in a new block */
+        void **block = malloc(PATH_BLOCK_SIZE);
+        if (block == NULL) {
+            printf("Failed to allocate %dB for path buffer\n", PATH_BLOCK_SIZE);
+            return NULL;
+        }
+        block[0] = pool->paths_block;
+        pool->paths_block = block;
+        tarchivist_arena_init(&pool->paths, &block[1], PATH_BLOCK_SIZE - sizeof(void *));
+
+        full_path = pool->paths.allocator.alloc(pool->paths.allocator.ctx, path_length);
+    }
+
+    snprintf(full_path, path_length, "%s/%s", dir, name);
+    return full_path;
+}
+
+static void packer_free_paths(unpack_pool_t *pool) {
+    while (pool->paths_block != NULL) {
+        void **block = pool->paths_block;
+        pool->paths_block = block[0];
+        free(block);
+    }
+}
+
+static int packer_unpack_job(int archive_fd, const unpack_job_t *job, cache_batch_t *batch, char *buffer, size_t buffer_size) {
+    int dst_fd = open(job->path, O_WRONLY | O_CREAT | O_TRUNC, 0644); // If such file already existed, now it's gone
+    if (dst_fd < 0) {
+        printf("Failed to open file %s to write\n", job->path);
+        return PACKER_OPENFAIL;
+    }
+
+    printf("Unpacking file %s (%zu.%03zuKiB)\n", job->path, (size_t)(job->size / 1024), (size_t)(job->size % 1024));
+
+    /* Explicit source offsets don't move the shared descriptor's offset, so the workers don't interfere */
+    int err = packer_copy(archive_fd, job->data_offset, dst_fd, 0, job->size, buffer, buffer_size);
+    packer_cache_advise(archive_fd, job->data_offset, job->size, true);
+
+    const int close_err = packer_close_extracted(batch, dst_fd, job->size);
+    if (close_err != PACKER_SUCCESS && err == PACKER_SUCCESS) {
+        err = close_err;
+    }
+    return err;
+}
+
+static void *packer_unpack_worker(void *arg) {
+    unpack_pool_t *pool = arg;
+    const unpack_job_t *job;
+    cache_batch_t batch = {0};
+
+    char *buffer = malloc(STREAM_BUFFER_SIZE);
+    if (buffer == NULL) {
+        printf("Failed to allocate %dB for stream buffer\n", STREAM_BUFFER_SIZE);
+        pthread_mutex_lock(&pool->lock);
+        pool->err = PACKER_NOMEMORY;
+        pthread_mutex_unlock(&pool->lock);
+        return NULL;
+    }
+
+    while (1) {
+        /* Take the next job, stop on the first error in any of the workers */
+        pthread_mutex_lock(&pool->lock);
+        if (pool->err != PACKER_SUCCESS || pool->next_job == pool->jobs_count) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        job = &pool->jobs[pool->next_job++];
+        pthread_mutex_unlock(&pool->lock);
+
+        const int err = packer_unpack_job(pool->archive_fd, job, &batch, buffer, STREAM_BUFFER_SIZE);
+        if (err != PACKER_SUCCESS) {
+            pthread_mutex_lock(&pool->lock);
+            pool->err = err;
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+
+    if (packer_cache_flush(&batch) != PACKER_SUCCESS) {
+        pthread_mutex_lock(&pool->lock);
+        pool->err = PACKER_CLOSEFAIL;
+        pthread_mutex_unlock(&pool->lock);
+    }
+    free(buffer);
+    return NULL;
+}
+
+static int packer_add_job(unpack_pool_t *pool, const tarchivist_header_t *header, const tarchivist_iter_t *iter, const char *dir) {
+    if (pool->jobs_count == pool->jobs_capacity) {
+        const size_t capacity = (pool->jobs_capacity > 0) ? (2 * pool->jobs_capacity) : 64;
+        unpack_job_t *jobs = realloc(pool->jobs, capacity * sizeof(unpack_job_t));
+        if (jobs == NULL) {
+            printf("Failed to allocate %zuB for job list\n", capacity * sizeof(unpack_job_t));
+            return PACKER_NOMEMORY;
+        }
+        pool->jobs = jobs;
+        pool->jobs_capacity = capacity;
+    }
+
+    unpack_job_t *job = &pool->jobs[pool->jobs_count];
+    job->path = packer_join_path(pool, dir, header->name);
+    if (job->path == NULL) {
+        return PACKER_NOMEMORY;
+    }
+    job->data_offset = iter->data_pos;
+    job->size = header->size;
+    pool->jobs_count++;
+
+    return PACKER_SUCCESS;
+}
+
+/* Reads all the headers in a single pass, creating the directories right away
+ * and collecting the files, so that their parents exist before any of them is written */
+static int packer_scan(unpack_pool_t *pool, const char *tarname, const char *dir) {
+    tarchivist_t tar;
+    tarchivist_header_t header;
+    tarchivist_iter_t iter;
+    int lib_err;
+    int err = PACKER_SUCCESS;
+
+    if (tarchivist_open(&tar, tarname, "r") != TARCHIVIST_SUCCESS) {
+        printf("Failed to open archive %s in mode r\n", tarname);
+        return PACKER_LIBERROR;
+    }
+
+    tarchivist_iter_init(&tar, &iter);
+    while ((lib_err = tarchivist_iter_next(&iter, &header)) == TARCHIVIST_SUCCESS) {
+        switch (header.typeflag) {
+            case TARCHIVIST_FILE:
+                err = packer_add_job(pool, &header, &iter, dir);
+                break;
+            case TARCHIVIST_DIR:
+                err = packer_unpack_directory(&header, dir);
+                break;
+            default:
+                printf("Unhandled case in unpack: %d\n", header.typeflag);
+                err = PACKER_FAILURE;
+                break;
+        }
+
+        if (err != PACKER_SUCCESS) {
+            break;
+        }
+    }
+
+    if (err == PACKER_SUCCESS && lib_err != TARCHIVIST_NULLRECORD) {
+        err = PACKER_LIBERROR;
+    }
+
+    tarchivist_close(&tar);
+    return err;
+}
+
 static int packer_init(const char *tarname, const char *mode) {
     if (tarchivist_open(&ctx.tar, tarname, mode) != TARCHIVIST_SUCCESS) {
         printf("Failed to open archive %s in mode %s\n", tarname, mode);
         return PACKER_LIBERROR;
     }
 
+    if (drop_cache && tarchivist_set_cache_policy(&ctx.tar, TARCHIVIST_CACHE_DROP) != TARCHIVIST_SUCCESS) {
+        printf("Archive %s has no page cache to drop\n", tarname); // Pipe, nothing to worry about
+    }
+
     ctx.buffer_size = STREAM_BUFFER_SIZE;
     ctx.buffer = calloc(1, ctx.buffer_size);
     if (ctx.buffer == NULL) {
@@ -289,6 +922,9 @@ static int packer_init(const char *tarname, const char *mode) {
 }
 
 static int packer_deinit(void) {
+    if (packer_cache_flush(&ctx.batch) != PACKER_SUCCESS) {
+        printf("Failed to close extracted files\n");
+    }
     if (tarchivist_close(&ctx.tar) != TARCHIVIST_SUCCESS) {
         printf("Failed to close archive\n");
         free(ctx.buffer);
@@ -299,6 +935,10 @@ static int packer_deinit(void) {
     return PACKER_SUCCESS;
 }
 
+void packer_drop_cache(bool enabled) {
+    drop_cache = enabled;
+}
+
 int packer_pack(const char *tarname, const char *dir) {
     int err = packer_init(tarname, "a");
     if (err != PACKER_SUCCESS) {
@@ -313,7 +953,7 @@ int packer_pack(const char *tarname, const char *dir) {
 
 int packer_unpack(const char *dir, const char *tarname) {
     int lib_err;
-    int err = packer_init(tarname, "r");
+    int err = packer_init(tarname, (strcmp(tarname, STDIN_PATH) == 0) ? "rs" : "r"); // Standard input can only be read forward
     if (err != PACKER_SUCCESS) {
         return err;
     }
@@ -368,3 +1008,170 @@ int packer_unpack(const char *dir, const char *tarname) {
     packer_deinit();
     return err;
 }
+
+int packer_unpack_parallel(const char *dir, const char *tarname, unsigned jobs) {
+    unpack_pool_t pool = {0};
+    pthread_t *workers;
+    unsigned workers_count = 0;
+
+    /* Workers need random access to the archive, standard input has to be unpacked serially */
+    if (strcmp(tarname, STDIN_PATH) == 0) {
+        return packer_unpack(dir, tarname);
+    }
+
+    const size_t dir_length = strlen(dir) + 1;
+    char *dir_cleaned = calloc(1, dir_length);
+    if (dir_cleaned == NULL) {
+        printf("Failed to allocate %zuB for path buffer\n", dir_length);
+        return PACKER_NOMEMORY;
+    }
+    snprintf(dir_cleaned, dir_length, "%s", dir);
+
+    /* Directory path cleanup */
+    packer_remove_duplicated_slashes(dir_cleaned);
+    packer_remove_trailing_slash(dir_cleaned);
+
+    tarchivist_arena_init(&pool.paths, NULL, 0); // First path gets the first block
+    int err = packer_scan(&pool, tarname, dir_cleaned);
+
+    do
+    {
+        if (err != PACKER_SUCCESS) {
+            break;
+        }
+
+        /* Descriptor shared by all the workers */
+        pool.archive_fd = open(tarname, O_RDONLY);
+        if (pool.archive_fd < 0) {
+            printf("Failed to open archive %s\n", tarname);
+            err = PACKER_OPENFAIL;
+            break;
+        }
+
+        workers = calloc(jobs, sizeof(pthread_t));
+        if (workers == NULL) {
+            printf("Failed to allocate %zuB for worker threads\n", jobs * sizeof(pthread_t));
+            err = PACKER_NOMEMORY;
+            close(pool.archive_fd);
+            break;
+        }
+
+        pthread_mutex_init(&pool.lock, NULL);
+        for (; workers_count < jobs; workers_count++) {
+            if (pthread_create(&workers[workers_count], NULL, packer_unpack_worker, &pool) != 0) {
+                break;
+            }
+        }
+
+        /* If no thread could be started, do the job in this one */
+        if (workers_count == 0) {
+            packer_unpack_worker(&pool);
+        }
+        for (unsigned i = 0; i < workers_count; i++) {
+            pthread_join(workers[i], NULL);
+        }
+        pthread_mutex_destroy(&pool.lock);
+
+        err = pool.err;
+        free(workers);
+        if (close(pool.archive_fd) != 0 && err == PACKER_SUCCESS) {
+            err = PACKER_CLOSEFAIL;
+        }
+
+    } while (0);
+
+    packer_free_paths(&pool);
+    free(pool.jobs);
+    free(dir_cleaned);
+    return err;
+}
+
+int packer_pack_parallel(const char *tarname, const char *dir, unsigned jobs, size_t budget) {
+    pack_pool_t pool = {0};
+    pthread_t *readers = NULL;
+    unsigned readers_count = 0;
+
+    pool.budget = budget;
+    pack_pool = &pool;
+
+    /* Walk the tree first, so that the order of the members is known upfront */
+    int err = ftw(dir, packer_ftw_collect_callback, FTW_MAX_DIRS_OPENED);
+
+    do
+    {
+        if (err != PACKER_SUCCESS) {
+            break;
+        }
+
+        pool.chunks = calloc(pool.chunks_count + 1, sizeof(pack_chunk_t));
+        pool.buffers_capacity = pool.budget / PACK_CHUNK_SIZE + 1; // The chunk the writer waits for may exceed the budget
+        pool.buffers = calloc(pool.buffers_capacity, sizeof(char *));
+        readers = calloc(jobs, sizeof(pthread_t));
+        if (pool.chunks == NULL || pool.buffers == NULL || readers == NULL) {
+            printf("Failed to allocate memory for chunk list\n");
+            err = PACKER_NOMEMORY;
+            break;
+        }
+        for (size_t i = 0; i < pool.entries_count; i++) {
+            for (size_t j = 0; j < pool.entries[i].chunks_count; j++) {
+                pool.chunks[pool.entries[i].first_chunk + j].entry = i;
+            }
+        }
+
+        err = packer_init(tarname, "a");
+        if (err != PACKER_SUCCESS) {
+            break;
+        }
+
+        pthread_mutex_init(&pool.lock, NULL);
+        pthread_cond_init(&pool.cond, NULL);
+        for (; readers_count < jobs; readers_count++) {
+            if (pthread_create(&readers[readers_count], NULL, packer_pack_reader, &pool) != 0) {
+                break;
+            }
+        }
+
+        if (readers_count == 0) {
+            printf("Failed to start reader threads\n");
+            err = PACKER_FAILURE;
+        }
+        else {
+            err = packer_pack_writer(&pool);
+            if (err != PACKER_SUCCESS) {
+                packer_pool_fail(&pool, err);
+            }
+        }
+
+        for (unsigned i = 0; i < readers_count; i++) {
+            pthread_join(readers[i], NULL);
+        }
+        pthread_cond_destroy(&pool.cond);
+        pthread_mutex_destroy(&pool.lock);
+
+        packer_deinit();
+
+    } while (0);
+
+    if (pool.chunks != NULL) {
+        for (size_t i = 0; i < pool.chunks_count; i++) {
+            free(pool.chunks[i].data);
+        }
+    }
+    for (size_t i = 0; i < pool.buffers_count; i++) {
+        free(pool.buffers[i]);
+    }
+    for (size_t i = 0; i < pool.entries_count; i++) {
+        /* Files left open by the readers that stopped on an error */
+        if (pool.entries[i].fd >= 0 && pool.entries[i].chunks_read < pool.entries[i].chunks_count) {
+            close(pool.entries[i].fd);
+        }
+        free(pool.entries[i].path);
+        free(pool.entries[i].name);
+    }
+    free(pool.entries);
+    free(pool.buffers);
+    free(pool.chunks);
+    free(readers);
+    pack_pool = NULL;
+    return err;
+}
@@ -8,6 +8,9 @@
 #ifndef __PACKER_H__
 #define __PACKER_H__
 
+#include <stddef.h>
+#include <stdbool.h>
+
 enum {
     PACKER_SUCCESS = 0,
     PACKER_FAILURE = -1,
@@ -17,7 +20,10 @@ enum {
     PACKER_CLOSEFAIL = -4
 };
 
+void packer_drop_cache(bool enabled);
 int packer_pack(const char *tarname, const char *dir);
+int packer_pack_parallel(const char *tarname, const char *dir, unsigned jobs, size_t budget);
 int packer_unpack(const char *dir, const char *tarname);
+int packer_unpack_parallel(const char *dir, const char *tarname, unsigned jobs);
 
 #endif
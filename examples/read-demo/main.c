@@ -29,6 +29,7 @@ const char *const file_to_read = "file_1.txt";
 
 int main(void) {
     tarchivist_t tar;
+    tarchivist_iter_t iter;
     tarchivist_header_t header;
     char *file_content = NULL;
     int err;
@@ -47,9 +48,9 @@ int main(void) {
 
         printf("Listing the files present in the archive...\n\n");
         printf("|  name  | size |  timestamp  |  type  |  user name  |  group name  |\n\n");
-        while (tarchivist_read_header(&tar, &header) == TARCHIVIST_SUCCESS) {
-            printf("| %s | %uB | %u | %c | %s | %s |\n", header.name, header.size, header.mtime, header.typeflag, header.uname, header.gname);
-            tarchivist_next(&tar);
+        tarchivist_iter_init(&tar, &iter);
+        while (tarchivist_iter_next(&iter, &header) == TARCHIVIST_SUCCESS) {
+            printf("| %s | %lluB | %u | %c | %s | %s |\n", header.name, (unsigned long long)header.size, header.mtime, header.typeflag, header.uname, header.gname);
         }
 
         printf("\nSearching file %s and printing its content...\n\n", file_to_read);
@@ -61,7 +62,7 @@ int main(void) {
 
         file_content = calloc(1, header.size + 1);
         if (file_content == NULL) {
-            printf("Error: failed to allocate %zuB for file content buffer!\n", header.size + 1);
+            printf("Error: failed to allocate %lluB for file content buffer!\n", (unsigned long long)header.size + 1);
             break;
         }
 
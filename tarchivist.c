@@ -22,16 +22,81 @@
  * IN THE SOFTWARE.
  */
 
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(TARCHIVIST_NO_POSIX)
+#define TARCHIVIST_POSIX
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+#define _FILE_OFFSET_BITS 64 /* 64-bit off_t for fseeko and ftello on 32-bit systems */
+#ifdef __linux__
+#define _GNU_SOURCE /* sync_file_range */
+#endif
+#if defined(TARCHIVIST_URING) && defined(__linux__)
+#define TARCHIVIST_URING_BACKEND
+#define _DEFAULT_SOURCE /* syscall */
+#endif
+#endif
+
 #include "tarchivist.h"
 
 #include <stdlib.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <limits.h>
 #include <string.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifdef TARCHIVIST_POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#endif
+
+#ifdef TARCHIVIST_URING_BACKEND
+#include <errno.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
 #define TARCHIVIST_CLOSING_RECORD_SIZE (2 * TARCHIVIST_TAR_BLOCK_SIZE)
 #define TARCHIVIST_MAGIC "ustar"
 #define TARCHIVIST_VERSION "00"
+#define TARCHIVIST_NAME_SIZE 100
+#define TARCHIVIST_PREFIX_SIZE 155
+#define TARCHIVIST_PATH_MAX (TARCHIVIST_PREFIX_SIZE + 1 + TARCHIVIST_NAME_SIZE + 1) /* Prefix, slash, name and null-terminator */
+#define TARCHIVIST_POOL_BLOCK_SIZE (64 * 1024)
+#define TARCHIVIST_INDEX_MIN_CAPACITY 64
+#define TARCHIVIST_LIST_MIN_CAPACITY 1024
+#define TARCHIVIST_LIST_MEMBER_SIZE (3 * sizeof(int64_t) + sizeof(size_t) + sizeof(unsigned) + sizeof(char)) /* Bytes of all the arrays per member */
+#define TARCHIVIST_ARENA_ALIGNMENT 16
+#define TARCHIVIST_MATCHER_MIN_CAPACITY 16
+#define TARCHIVIST_NO_PATTERN UINT_MAX
+#define TARCHIVIST_OCTAL_SIZE_MAX 077777777777ULL /* 11 octal digits */
+#define TARCHIVIST_PAX_PREFIX "PaxHeaders/"
+#define TARCHIVIST_PAX_BUFFER_SIZE (2 * TARCHIVIST_TAR_BLOCK_SIZE)
+#define TARCHIVIST_PAX_SIZE_MAX (1024 * 1024) /* Extended headers larger than that are not supported */
+#define TARCHIVIST_BUFFER_ALIGNMENT 4096
+#define TARCHIVIST_MEM_CHUNK_SIZE_MAX (16 * 1024 * 1024) /* Chunks stop growing at this size */
+#define TARCHIVIST_MEMBER_IOV_SIZE 16 /* Vectors of a member gathered on the stack, more are written in batches */
+#define TARCHIVIST_WRITE_CHUNK_SIZE (1024U * 1024U * 1024U) /* Vector larger than that is split into several write calls */
+#define TARCHIVIST_DISCARD_BUFFER_SIZE (8 * TARCHIVIST_TAR_BLOCK_SIZE)
+#define TARCHIVIST_URING_DEPTH 8 /* Operations in flight at once */
+#define TARCHIVIST_URING_SLOT_SIZE (64 * 1024)
+#define TARCHIVIST_READAHEAD_DEPTH 8 /* Default number of members prefetched */
+#define TARCHIVIST_READAHEAD_BUDGET (4 * 1024 * 1024) /* Default limit of the prefetched data */
+#define TARCHIVIST_READAHEAD_DATA_SIZE (64 * 1024) /* Data of a member prefetched along with its header */
+#define TARCHIVIST_READAHEAD_META_SIZE (2 * TARCHIVIST_TAR_BLOCK_SIZE + TARCHIVIST_PAX_BUFFER_SIZE) /* Headers prefetched per member, larger extended headers are left to the stream */
+#define TARCHIVIST_CACHE_BATCH_SIZE (8 * 1024 * 1024) /* Archive data dropped from the page cache at once */
+#define TARCHIVIST_TRAILER_NAME ".tarchivist-index"
+#define TARCHIVIST_TRAILER_MAGIC "tarchivist-idx2" /* Including null-terminator fills 16 bytes */
+#define TARCHIVIST_TRAILER_RECORD_SIZE 27 /* Header offset, data offset, size, typeflag and path length */
 
 /* USTAR format */
 typedef struct tarchivist_raw_header_t {
@@ -54,47 +119,192 @@ typedef struct tarchivist_raw_header_t {
     char padding[12];   /* Padding to 512 bytes */
 } tarchivist_raw_header_t;
 
+/* Long enough for the closing record, padding takes less than a block */
+static const char tarchivist_zero_block[TARCHIVIST_CLOSING_RECORD_SIZE];
+
+/* Block of the path storage used by the index, paths never move once stored */
+typedef struct tarchivist_pool_block_t {
+    struct tarchivist_pool_block_t *next;
+    unsigned used;
+    char data[TARCHIVIST_POOL_BLOCK_SIZE];
+} tarchivist_pool_block_t;
+
+/* Memory comes from the allocator if there is one, from the heap otherwise */
+static void *tarchivist_alloc(const tarchivist_allocator_t *allocator, size_t size) {
+    return (allocator != NULL) ? allocator->alloc(allocator->ctx, size) : malloc(size);
+}
+
+static void *tarchivist_resize(const tarchivist_allocator_t *allocator, void *ptr, size_t old_size, size_t size) {
+    return (allocator != NULL) ? allocator->resize(allocator->ctx, ptr, old_size, size) : realloc(ptr, size);
+}
+
+static void tarchivist_release(const tarchivist_allocator_t *allocator, void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return;
+    }
+    if (allocator != NULL) {
+        allocator->release(allocator->ctx, ptr, size);
+    }
+    else {
+        free(ptr);
+    }
+}
+
+/* Sum of all bytes of the header block */
+static unsigned tarchivist_sum_bytes(const uint8_t *data) {
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+    __m128i sum;
+    unsigned i;
+
+    /* SAD against zero sums each group of 8 bytes into a 64-bit lane */
+    for (i = 0; i < sizeof(tarchivist_raw_header_t); i += sizeof(__m256i)) {
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(data + i)), zero));
+    }
+    sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+    return (unsigned)_mm_cvtsi128_si32(sum);
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    unsigned i;
+
+    /* SAD against zero sums each group of 8 bytes into a 64-bit lane */
+    for (i = 0; i < sizeof(tarchivist_raw_header_t); i += sizeof(__m128i)) {
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(data + i)), zero));
+    }
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+    return (unsigned)_mm_cvtsi128_si32(acc);
+#else
+    unsigned sums[4] = {0};
+    unsigned i;
+
+    /* Independent accumulators let the compiler vectorize the loop */
+    for (i = 0; i < sizeof(tarchivist_raw_header_t); i += 4) {
+        sums[0] += data[i];
+        sums[1] += data[i + 1];
+        sums[2] += data[i + 2];
+        sums[3] += data[i + 3];
+    }
+    return sums[0] + sums[1] + sums[2] + sums[3];
+#endif
+}
+
 static unsigned tarchivist_compute_checksum(const tarchivist_raw_header_t *header) {
-    const uint8_t *header_byte_ptr = (const uint8_t *) header;
-    const unsigned checksum_start = offsetof(tarchivist_raw_header_t, checksum);
-    const unsigned checksum_end = checksum_start + sizeof(header->checksum);
-    unsigned checksum = 0;
+    const uint8_t *checksum_ptr = (const uint8_t *)header->checksum;
+    unsigned checksum = tarchivist_sum_bytes((const uint8_t *)header);
     unsigned i;
 
     /* Checksum is computed as if the checksum field is all spaces */
-    for (i = 0; i < sizeof(tarchivist_raw_header_t); ++i) {
-        if (i >= checksum_start && i < checksum_end) {
-            checksum += (unsigned)(' ');
+    for (i = 0; i < sizeof(header->checksum); ++i) {
+        checksum += (unsigned)(' ') - checksum_ptr[i];
+    }
+
+    return checksum;
+}
+
+/* Converts octal field to the value. Just as sscanf's %o, skips leading spaces and stops
+ * at the first non-octal character, but never reads past the end of the field.
+ * GNU base-256 encoding (highest bit of the first byte set) is supported as well */
+static uint64_t tarchivist_parse_octal(const char *field, unsigned size) {
+    uint64_t value = 0;
+    unsigned digit;
+    unsigned i = 0;
+
+    if ((uint8_t)field[0] & 0x80) {
+        /* Negative values make no sense for any of the fields */
+        if ((uint8_t)field[0] & 0x40) {
+            return 0;
         }
-        else {
-            checksum += header_byte_ptr[i];
+        value = (uint8_t)field[0] & 0x3F;
+        for (i = 1; i < size; ++i) {
+            value = (value << 8) | (uint8_t)field[i];
         }
+        return value;
     }
 
-    return checksum;
+    while (i < size && field[i] == ' ') {
+        ++i;
+    }
+
+    for (; i < size; ++i) {
+        digit = (unsigned)(uint8_t)field[i] - '0';
+        if (digit > 7) {
+            break;
+        }
+        value = (value << 3) | digit;
+    }
+
+    return value;
+}
+
+/* Writes the value as zero-padded octal number filling the whole field but the null-terminator,
+ * returns the sum of written digits, which allows to update the checksum without recomputing it */
+static unsigned tarchivist_format_octal(char *field, unsigned size, uint64_t value) {
+    unsigned sum = 0;
+    unsigned i = size - 1;
+
+    field[i] = '\0';
+    while (i > 0) {
+        field[--i] = (char)('0' + (value & 7));
+        sum += (uint8_t)field[i];
+        value >>= 3;
+    }
+
+    return sum;
+}
+
+/* Size field too small for an octal number is stored in GNU base-256 encoding */
+static unsigned tarchivist_format_size(char *field, unsigned size, uint64_t value) {
+    unsigned sum = 0x80;
+    unsigned i;
+
+    if (value <= TARCHIVIST_OCTAL_SIZE_MAX) {
+        return tarchivist_format_octal(field, size, value);
+    }
+
+    field[0] = (char)0x80;
+    for (i = size - 1; i > 0; --i) {
+        field[i] = (char)(value & 0xFF);
+        sum += (uint8_t)field[i];
+        value >>= 8;
+    }
+
+    return sum;
 }
 
 static int tarchivist_validate_checksum(const tarchivist_raw_header_t *header) {
     const unsigned real_checksum = tarchivist_compute_checksum(header);
-    unsigned stored_checksum;
+    const unsigned stored_checksum = (unsigned)tarchivist_parse_octal(header->checksum, sizeof(header->checksum));
 
-    /* Convert octal string to decimal value */
-    sscanf(header->checksum, "%o", &stored_checksum);
     return (real_checksum == stored_checksum) ? TARCHIVIST_SUCCESS : TARCHIVIST_BADCHKSUM;
 }
 
-static unsigned tarchivist_round_up(unsigned value, unsigned multiple) {
+static uint64_t tarchivist_round_up(uint64_t value, unsigned multiple) {
     return value + (multiple - (value % multiple)) % multiple;
 }
 
-static int tarchivist_seek_impl(tarchivist_t *tar, long offset, int whence) {
+/* 64-bit offsets in stdio */
+#if defined(TARCHIVIST_POSIX)
+#define tarchivist_fseek(stream, offset, whence) fseeko((stream), (off_t)(offset), (whence))
+#define tarchivist_ftell(stream) ((int64_t)ftello(stream))
+#elif defined(_WIN32)
+#define tarchivist_fseek(stream, offset, whence) _fseeki64((stream), (offset), (whence))
+#define tarchivist_ftell(stream) ((int64_t)_ftelli64(stream))
+#else
+#define tarchivist_fseek(stream, offset, whence) fseek((stream), (long)(offset), (whence))
+#define tarchivist_ftell(stream) ((int64_t)ftell(stream))
+#endif
+
+static int tarchivist_seek_impl(tarchivist_t *tar, int64_t offset, int whence) {
     int err;
     switch (whence) {
         case TARCHIVIST_SEEK_SET:
-            err = fseek(tar->stream, offset, SEEK_SET);
+            err = tarchivist_fseek(tar->stream, offset, SEEK_SET);
             break;
         case TARCHIVIST_SEEK_END:
-            err = fseek(tar->stream, offset, SEEK_END);
+            err = tarchivist_fseek(tar->stream, offset, SEEK_END);
             break;
         default:
             return TARCHIVIST_SEEKFAIL;
@@ -103,8 +313,8 @@ static int tarchivist_seek_impl(tarchivist_t *tar, long offset, int whence) {
     return (err == 0) ? TARCHIVIST_SUCCESS : TARCHIVIST_SEEKFAIL;
 }
 
-static long tarchivist_tell_impl(tarchivist_t *tar) {
-    const long pos = ftell(tar->stream);
+static int64_t tarchivist_tell_impl(tarchivist_t *tar) {
+    const int64_t pos = tarchivist_ftell(tar->stream);
     if (pos < 0) {
         return TARCHIVIST_SEEKFAIL;
     }
@@ -126,442 +336,4649 @@ static int tarchivist_close_impl(tarchivist_t *tar) {
     return (err == 0) ? TARCHIVIST_SUCCESS : TARCHIVIST_CLOSEFAIL;
 }
 
-static int tarchivist_rewind(tarchivist_t *tar) {
-    tar->last_header_pos = 0;
-    tar->bytes_left = 0;
-    return tar->seek(tar, 0, TARCHIVIST_SEEK_SET);
+/* Standard streams are not owned by the archive, so they are left open */
+static int tarchivist_close_std_impl(tarchivist_t *tar) {
+    if (tar->stream == stdout && fflush(stdout) != 0) {
+        return TARCHIVIST_CLOSEFAIL;
+    }
+    return TARCHIVIST_SUCCESS;
 }
 
-static int tarchivist_raw_to_header(tarchivist_header_t *header, const tarchivist_raw_header_t *raw_header) {
-    /* Assume that checksum starting with a null byte indicates a null record */
-    if (raw_header->checksum[0] == '\0') {
-        return TARCHIVIST_NULLRECORD;
-    }
+#ifdef TARCHIVIST_POSIX
+/* Positional read of the whole range, independent of the position of the descriptor */
+static bool tarchivist_pread_fd(int fd, void *data, size_t size, int64_t offset) {
+    ssize_t ret;
 
-    if (tarchivist_validate_checksum(raw_header) != TARCHIVIST_SUCCESS) {
-        return TARCHIVIST_BADCHKSUM;
+    while (size > 0) {
+        ret = pread(fd, data, size, (off_t)offset);
+        if (ret <= 0) {
+            return false;
+        }
+        data = (uint8_t *)data + ret;
+        size -= (size_t)ret;
+        offset += ret;
     }
+    return true;
+}
 
-    /* Parse and load raw header to header */
-    memcpy(header->name, raw_header->name, sizeof(header->name));
-    sscanf(raw_header->mode, "%o", &header->mode);
-    sscanf(raw_header->uid, "%o", &header->uid);
-    sscanf(raw_header->gid, "%o", &header->gid);
-    sscanf(raw_header->size, "%o", &header->size);
-    sscanf(raw_header->mtime, "%o", &header->mtime);
-    header->typeflag = raw_header->typeflag;
-    memcpy(header->linkname, raw_header->linkname, sizeof(header->linkname));
-    memcpy(header->uname, raw_header->uname, sizeof(header->uname));
-    memcpy(header->gname, raw_header->gname, sizeof(header->gname));
-    sscanf(raw_header->devmajor, "%o", &header->devmajor);
-    sscanf(raw_header->devminor, "%o", &header->devminor);
-    memcpy(header->prefix, raw_header->prefix, sizeof(header->prefix));
-
-    return TARCHIVIST_SUCCESS;
+/* Reads through the descriptor of the stdio stream, so neither the stream position nor its buffer are affected */
+static int tarchivist_pread_impl(tarchivist_t *tar, int64_t offset, unsigned size, void *data) {
+    return tarchivist_pread_fd(fileno(tar->stream), data, size, offset) ? TARCHIVIST_SUCCESS : TARCHIVIST_READFAIL;
 }
 
-static int tarchivist_header_to_raw(tarchivist_raw_header_t *raw_header, const tarchivist_header_t *header) {
-    unsigned checksum;
+/* Headers and the beginning of the data of a single member */
+typedef struct tarchivist_prefetch_t {
+    struct tarchivist_prefetch_t *next;
+    int64_t offset;
+    unsigned length;
+    uint8_t *data;
+} tarchivist_prefetch_t;
 
-    /* Clear header */
-    memset(raw_header, 0, sizeof(tarchivist_raw_header_t));
+/* Background thread reading the members ahead of the consumer with pread, independently of the stream */
+struct tarchivist_readahead_t {
+    int (*seek) (tarchivist_t *tar, int64_t offset, int whence); /* Callbacks of the stream being wrapped */
+    int64_t (*tell) (tarchivist_t *tar);
+    int (*read) (tarchivist_t *tar, unsigned size, void *data);
+    int fd;
+    int64_t pos;           /* Position of the consumer */
+    bool stream_behind;    /* Stream has not been moved past the data served from the prefetched members */
+    unsigned depth;
+    size_t budget;
+    unsigned data_size;    /* Data prefetched per member */
+    tarchivist_prefetch_t *slots; /* All the slots, allocated at once on start */
+    tarchivist_prefetch_t *free;  /* Slots not holding any member */
+    tarchivist_prefetch_t *head;
+    tarchivist_prefetch_t *tail;
+    size_t used;
+    int64_t scan_pos;      /* Header of the next member to be prefetched */
+    bool at_end;           /* Nothing more to prefetch until the consumer moves elsewhere */
+    unsigned generation;   /* Incremented when the consumer moves elsewhere */
+    bool stop;
+    tarchivist_readahead_stats_t stats;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
 
-    /* Parse and load header to raw header */
-    memcpy(raw_header->name, header->name, sizeof(raw_header->name));
-    sprintf(raw_header->mode, "%o", header->mode);
-    sprintf(raw_header->uid, "%o", header->uid);
-    sprintf(raw_header->gid, "%o", header->gid);
-    sprintf(raw_header->size, "%o", header->size);
-    sprintf(raw_header->mtime, "%o", header->mtime);
-    raw_header->typeflag = header->typeflag;
-    memcpy(raw_header->linkname, header->linkname, sizeof(raw_header->linkname));
-    memcpy(raw_header->magic, TARCHIVIST_MAGIC, sizeof(raw_header->magic));
-    memcpy(raw_header->version, TARCHIVIST_VERSION, sizeof(raw_header->version));
-    memcpy(raw_header->uname, header->uname, sizeof(raw_header->uname));
-    memcpy(raw_header->gname, header->gname, sizeof(raw_header->gname));
-    sprintf(raw_header->devmajor, "%o", header->devmajor);
-    sprintf(raw_header->devminor, "%o", header->devminor);
-    memcpy(raw_header->prefix, header->prefix, sizeof(raw_header->prefix));
+#endif
 
-    /* Compute checksum */
-    checksum = tarchivist_compute_checksum(raw_header);
-    sprintf(raw_header->checksum, "%06o", checksum);
-    raw_header->checksum[7] = ' ';
+/* Descriptor underlying the stream, only available for the default stdio stream */
+static int tarchivist_stream_fd(tarchivist_t *tar) {
+#ifdef TARCHIVIST_POSIX
+    /* Read-ahead wraps the callbacks, but the stream underneath stays the same */
+    int (*seek) (tarchivist_t *tar, int64_t offset, int whence) = (tar->readahead != NULL) ? tar->readahead->seek : tar->seek;
 
-    return TARCHIVIST_SUCCESS;
+    if (seek == tarchivist_seek_impl && tar->stream != NULL) {
+        /* Buffered data has to reach the descriptor before anyone else touches it */
+        if (fflush(tar->stream) != 0) {
+            return TARCHIVIST_WRITEFAIL;
+        }
+        return fileno(tar->stream);
+    }
+#else
+    (void)tar;
+#endif
+    return TARCHIVIST_NOTSUPPORTED;
 }
 
-int tarchivist_skip_closing_record(tarchivist_t *tar) {
-    tarchivist_header_t header;
-    char *buffer;
-    char *zeros;
-    long size;
-    int err;
+#if defined(TARCHIVIST_POSIX) && defined(__linux__)
+static void tarchivist_cache_sync(int fd, int64_t from, int64_t to, bool wait) {
+    const unsigned flags = wait ? (SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) : SYNC_FILE_RANGE_WRITE;
+    if (to > from) { /* Zero length would mean the whole rest of the file */
+        sync_file_range(fd, (off_t)from, (off_t)(to - from), flags);
+    }
+}
+#endif
 
-    /* Get file size */
-    err = tar->seek(tar, 0, TARCHIVIST_SEEK_END);
-    if (err != TARCHIVIST_SUCCESS) {
-        return err;
+/* With the drop policy, the archive before pos is dropped from the page cache once a whole batch is behind it.
+ * Written data is pushed to the disk first, one batch behind, so that its writeback overlaps with filling the next batch */
+static void tarchivist_cache_release(tarchivist_t *tar, int64_t pos, bool force) {
+#if defined(TARCHIVIST_POSIX) && defined(POSIX_FADV_DONTNEED)
+    int64_t until = pos;
+    int64_t from;
+
+    if (tar->cache_policy != TARCHIVIST_CACHE_DROP || pos < 0) {
+        return;
+    }
+    /* Moved back, the data behind has been dropped already or will be read again */
+    if (pos < tar->cache_flushed) {
+        tar->cache_dropped = pos;
+        tar->cache_flushed = pos;
+        return;
+    }
+    if (!force && pos - tar->cache_flushed < TARCHIVIST_CACHE_BATCH_SIZE) {
+        return;
     }
-    size = tar->tell(tar);
 
-    /* Rewind back to the beginning of the file */
-    err = tar->seek(tar, 0, TARCHIVIST_SEEK_SET);
-    if (err != TARCHIVIST_SUCCESS) {
-        return err;
+    if (tar->finalize) {
+        /* Dirty pages are not dropped, stdio buffer has to reach the descriptor and then the disk */
+        if (tarchivist_stream_fd(tar) < 0) {
+            return;
+        }
+#ifdef __linux__
+        tarchivist_cache_sync(tar->cache_fd, tar->cache_dropped, tar->cache_flushed, true);
+        tarchivist_cache_sync(tar->cache_fd, tar->cache_flushed, pos, force);
+#endif
+        if (!force) {
+            until = tar->cache_flushed;
+        }
+        tar->cache_flushed = pos;
+    }
+    else {
+        tar->cache_flushed = pos;
     }
 
-    if (size < TARCHIVIST_CLOSING_RECORD_SIZE) {
-        return TARCHIVIST_SUCCESS; /* File contains some non-tar garbage that will be overwritten */    
+    /* Large folios straddling the previous boundary are only dropped when the range covers them entirely;
+     * they are aligned to their size, so starting at a multiple of the batch size covers them */
+    if (until > tar->cache_dropped) {
+        from = tar->cache_dropped - tar->cache_dropped % TARCHIVIST_CACHE_BATCH_SIZE;
+        posix_fadvise(tar->cache_fd, (off_t)from, (off_t)(until - from), POSIX_FADV_DONTNEED);
+        tar->cache_dropped = until;
     }
+#else
+    (void)tar;
+    (void)pos;
+    (void)force;
+#endif
+}
 
-    /* Check the first header */
-    err = tarchivist_read_header(tar, &header);
-    if (err == TARCHIVIST_BADCHKSUM || err == TARCHIVIST_NULLRECORD) {
-        return TARCHIVIST_SUCCESS; /* Again - some garbage or malformed tar */
+#ifdef TARCHIVIST_URING_BACKEND
+enum tarchivist_uring_slot_state_e {
+    TARCHIVIST_SLOT_FREE = 0,
+    TARCHIVIST_SLOT_READING,
+    TARCHIVIST_SLOT_READY,
+    TARCHIVIST_SLOT_FILLING,
+    TARCHIVIST_SLOT_WRITING
+};
+
+/* Buffer of a single read or write operation */
+typedef struct tarchivist_uring_slot_t {
+    uint8_t *data;
+    int64_t offset;  /* Position of the first byte of the slot in the file */
+    unsigned length; /* Bytes read or to be written */
+    unsigned done;   /* Bytes already written */
+    int state;
+} tarchivist_uring_slot_t;
+
+/* Stream of the io_uring backend. Reads are issued ahead of the position, writes are
+ * collected in the slots and submitted in batches, all at explicit offsets */
+typedef struct tarchivist_uring_t {
+    int fd;
+    int ring_fd;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    unsigned queued;    /* Operations waiting for submission */
+    unsigned in_flight; /* Operations submitted and not completed yet */
+    int64_t pos;
+    int64_t ahead;      /* End of the data requested by the read-ahead */
+    int filling;        /* Slot collecting the written data, -1 if none */
+    bool writing;       /* Last operation was a write */
+    int err;
+    uint8_t *memory;
+    tarchivist_uring_slot_t slots[TARCHIVIST_URING_DEPTH];
+} tarchivist_uring_t;
+
+static int tarchivist_uring_setup(tarchivist_uring_t *uring) {
+    struct io_uring_params params;
+    struct io_uring_probe *probe;
+    uint8_t *sq_ring, *cq_ring;
+    bool supported;
+
+    memset(&params, 0, sizeof(params));
+    uring->ring_fd = (int)syscall(__NR_io_uring_setup, TARCHIVIST_URING_DEPTH, &params);
+    if (uring->ring_fd < 0) {
+        return TARCHIVIST_NOTSUPPORTED;
     }
 
-    /* This algorithm will fail if tar is not finalized and last 1024 bytes of last file content are zeros */
-    do
-    {
-        buffer = calloc(1, TARCHIVIST_CLOSING_RECORD_SIZE);
-        zeros = calloc(1, TARCHIVIST_CLOSING_RECORD_SIZE);
-        if (buffer == NULL || zeros == NULL) {
-            err = TARCHIVIST_NOMEMORY;
-            break;
-        }
+    /* Plain reads and writes at offsets are newer than io_uring itself */
+    probe = calloc(1, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+    if (probe == NULL) {
+        return TARCHIVIST_NOTSUPPORTED;
+    }
+    supported = (syscall(__NR_io_uring_register, uring->ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+                 probe->last_op >= IORING_OP_WRITE &&
+                 (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+                 (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED));
+    free(probe);
+    if (!supported) {
+        return TARCHIVIST_NOTSUPPORTED;
+    }
 
-        /* Seek to the beginning of the closing record */
-        err = tar->seek(tar, -TARCHIVIST_CLOSING_RECORD_SIZE, TARCHIVIST_SEEK_END);
-        if (err != TARCHIVIST_SUCCESS) {
-            break;
+    uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring->cq_ring_size > uring->sq_ring_size) {
+            uring->sq_ring_size = uring->cq_ring_size;
         }
+        uring->cq_ring_size = 0;
+    }
 
-        /* Read the content of the closing record */
-        err = tar->read(tar, TARCHIVIST_CLOSING_RECORD_SIZE, buffer);
-        if (err != TARCHIVIST_SUCCESS) {
-            break;
+    uring->sq_ring = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_SQ_RING);
+    if (uring->sq_ring == MAP_FAILED) {
+        uring->sq_ring = NULL;
+        return TARCHIVIST_NOTSUPPORTED;
+    }
+    if (uring->cq_ring_size == 0) {
+        uring->cq_ring = uring->sq_ring;
+    }
+    else {
+        uring->cq_ring = mmap(NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_CQ_RING);
+        if (uring->cq_ring == MAP_FAILED) {
+            uring->cq_ring = NULL;
+            return TARCHIVIST_NOTSUPPORTED;
         }
+    }
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ring_fd, IORING_OFF_SQES);
+    if (uring->sqes == MAP_FAILED) {
+        uring->sqes = NULL;
+        return TARCHIVIST_NOTSUPPORTED;
+    }
 
-        /* Check whether it is closing record indeed */
-        if (memcmp(buffer, zeros, TARCHIVIST_CLOSING_RECORD_SIZE) == 0) {
-            /* Seek to the beginning of the closing record so that the next write will overwrite it */
-            err = tar->seek(tar, -TARCHIVIST_CLOSING_RECORD_SIZE, TARCHIVIST_SEEK_END);
-            break;
-        }
-        /* If it's not a closing record, do nothing */
+    sq_ring = uring->sq_ring;
+    cq_ring = uring->cq_ring;
+    uring->sq_tail = (unsigned *)(sq_ring + params.sq_off.tail);
+    uring->sq_mask = (unsigned *)(sq_ring + params.sq_off.ring_mask);
+    uring->sq_array = (unsigned *)(sq_ring + params.sq_off.array);
+    uring->cq_head = (unsigned *)(cq_ring + params.cq_off.head);
+    uring->cq_tail = (unsigned *)(cq_ring + params.cq_off.tail);
+    uring->cq_mask = (unsigned *)(cq_ring + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *)(cq_ring + params.cq_off.cqes);
 
-    } while (0);
+    return TARCHIVIST_SUCCESS;
+}
 
-    free(zeros);
-    free(buffer);
-    return err;
+static void tarchivist_uring_teardown(tarchivist_uring_t *uring) {
+    if (uring->sqes != NULL) {
+        munmap(uring->sqes, uring->sqes_size);
+    }
+    if (uring->cq_ring != NULL && uring->cq_ring != uring->sq_ring) {
+        munmap(uring->cq_ring, uring->cq_ring_size);
+    }
+    if (uring->sq_ring != NULL) {
+        munmap(uring->sq_ring, uring->sq_ring_size);
+    }
+    if (uring->ring_fd >= 0) {
+        close(uring->ring_fd);
+    }
+    if (uring->fd >= 0) {
+        close(uring->fd);
+    }
+    free(uring->memory);
+    free(uring);
 }
 
-int tarchivist_open(tarchivist_t *tar, const char *filename, const char *io_mode) {
-    tarchivist_header_t header;
-    int err;
+/* Puts the operation of the slot into the submission queue, it's submitted with the next tarchivist_uring_enter */
+static void tarchivist_uring_queue(tarchivist_uring_t *uring, unsigned slot_index, int state) {
+    tarchivist_uring_slot_t *slot = &uring->slots[slot_index];
+    const unsigned tail = *uring->sq_tail;
+    const unsigned index = tail & *uring->sq_mask;
+    struct io_uring_sqe *sqe = &uring->sqes[index];
 
-    if (tar == NULL || filename == NULL || io_mode == NULL) {
-        return TARCHIVIST_FAILURE;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = (state == TARCHIVIST_SLOT_READING) ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = uring->fd;
+    if (state == TARCHIVIST_SLOT_READING) {
+        sqe->addr = (uint64_t)(uintptr_t)(slot->data + slot->length);
+        sqe->len = TARCHIVIST_URING_SLOT_SIZE - slot->length;
+        sqe->off = (uint64_t)(slot->offset + slot->length);
+    }
+    else {
+        sqe->addr = (uint64_t)(uintptr_t)(slot->data + slot->done);
+        sqe->len = slot->length - slot->done;
+        sqe->off = (uint64_t)(slot->offset + slot->done);
     }
+    sqe->user_data = slot_index;
+    uring->sq_array[index] = index;
+    slot->state = state;
 
-    /* Clear tar struct */
-    memset(tar, 0, sizeof(tarchivist_t));
+    __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    uring->queued++;
+}
 
-    /* Assign default IO functions */
-    tar->seek = tarchivist_seek_impl;
-    tar->tell = tarchivist_tell_impl;
-    tar->read = tarchivist_read_impl;
-    tar->write = tarchivist_write_impl;
-    tar->close = tarchivist_close_impl;
+/* Submits the queued operations and handles the completed ones, waiting for at least one if asked to */
+static int tarchivist_uring_enter(tarchivist_uring_t *uring, bool wait) {
+    tarchivist_uring_slot_t *slot;
+    struct io_uring_cqe *cqe;
+    unsigned head, wait_nr = (wait && uring->queued + uring->in_flight > 0) ? 1 : 0;
+    long ret;
 
-    /* Ensure that file is opened and prepared properly */
-    switch (io_mode[0]) {
-        case 'r':
-            tar->finalize = false;
-            tar->stream = fopen(filename, "rb");
-            if (tar->stream == NULL) {
-                return TARCHIVIST_OPENFAIL;
+    if (uring->queued > 0 || wait_nr > 0) {
+        do {
+            ret = syscall(__NR_io_uring_enter, uring->ring_fd, uring->queued, wait_nr, (wait_nr > 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0) {
+            return TARCHIVIST_FAILURE;
+        }
+        uring->in_flight += (unsigned)ret;
+        uring->queued -= (unsigned)ret;
+    }
+
+    head = *uring->cq_head;
+    while (head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+        cqe = &uring->cqes[head & *uring->cq_mask];
+        slot = &uring->slots[cqe->user_data];
+        uring->in_flight--;
+
+        if (slot->state == TARCHIVIST_SLOT_READING) {
+            if (cqe->res < 0) {
+                uring->err = TARCHIVIST_READFAIL;
+                slot->state = TARCHIVIST_SLOT_FREE;
             }
-            /* Validate the file */
-            err = tarchivist_read_header(tar, &header);
-            if (err != TARCHIVIST_SUCCESS) {
-                fclose(tar->stream);
-                return err;
+            else {
+                slot->length += (unsigned)cqe->res;
+                slot->state = TARCHIVIST_SLOT_READY;
+                /* Short read, the slot is complete only when full or at the end of file */
+                if (cqe->res > 0 && slot->length < TARCHIVIST_URING_SLOT_SIZE) {
+                    tarchivist_uring_queue(uring, (unsigned)cqe->user_data, TARCHIVIST_SLOT_READING);
+                }
             }
-            break;
-
-        case 'w':
-            tar->finalize = true;
-            tar->stream = fopen(filename, "wb");
-            if (tar->stream == NULL) {
-                return TARCHIVIST_OPENFAIL;
+        }
+        else {
+            if (cqe->res <= 0) {
+                uring->err = TARCHIVIST_WRITEFAIL;
+                slot->state = TARCHIVIST_SLOT_FREE;
             }
-            break;
-
-        case 'a':
-            tar->finalize = true;
-            tar->stream = fopen(filename, "rb+"); /* Little hack to be able to append to arbitrary places in file */
-            if (tar->stream == NULL) {
-                tar->stream = fopen(filename, "wb");
-                if (tar->stream == NULL) {
-                    return TARCHIVIST_OPENFAIL;
+            else {
+                slot->done += (unsigned)cqe->res;
+                slot->state = TARCHIVIST_SLOT_FREE;
+                if (slot->done < slot->length) {
+                    tarchivist_uring_queue(uring, (unsigned)cqe->user_data, TARCHIVIST_SLOT_WRITING); /* Short write */
                 }
             }
+        }
+        head++;
+    }
+    __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+
+    return uring->err;
+}
 
-            err = tarchivist_skip_closing_record(tar);
+/* Waits until nothing is in flight and drops the data read ahead */
+static int tarchivist_uring_drain(tarchivist_uring_t *uring) {
+    unsigned i;
+    int err;
+
+    if (uring->filling >= 0) {
+        tarchivist_uring_queue(uring, (unsigned)uring->filling, TARCHIVIST_SLOT_WRITING);
+        uring->filling = -1;
+    }
+    while (uring->queued + uring->in_flight > 0) {
+        err = tarchivist_uring_enter(uring, true);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+    }
+
+    for (i = 0; i < TARCHIVIST_URING_DEPTH; ++i) {
+        uring->slots[i].state = TARCHIVIST_SLOT_FREE;
+    }
+    uring->ahead = uring->pos;
+    uring->writing = false;
+    return uring->err;
+}
+
+static int tarchivist_uring_seek(tarchivist_t *tar, int64_t offset, int whence) {
+    tarchivist_uring_t *uring = tar->stream;
+    struct stat statbuf;
+    int err;
+
+    switch (whence) {
+        case TARCHIVIST_SEEK_SET:
+            break;
+        case TARCHIVIST_SEEK_END:
+            /* Pending writes may extend the file */
+            err = tarchivist_uring_drain(uring);
             if (err != TARCHIVIST_SUCCESS) {
-                fclose(tar->stream);
                 return err;
             }
+            if (fstat(uring->fd, &statbuf) != 0) {
+                return TARCHIVIST_SEEKFAIL;
+            }
+            offset += statbuf.st_size;
             break;
-
         default:
-            return TARCHIVIST_OPENFAIL;
+            return TARCHIVIST_SEEKFAIL;
+    }
+    if (offset < 0) {
+        return TARCHIVIST_SEEKFAIL;
     }
 
+    /* Written data has to stay contiguous within the slot, the read-ahead is kept if it still helps */
+    if (uring->filling >= 0 && offset != uring->pos) {
+        tarchivist_uring_queue(uring, (unsigned)uring->filling, TARCHIVIST_SLOT_WRITING);
+        uring->filling = -1;
+    }
+    uring->pos = offset;
     return TARCHIVIST_SUCCESS;
 }
 
-int tarchivist_next(tarchivist_t *tar) {
-    tarchivist_header_t header;
-    unsigned record_size;
-    int err;
+static int64_t tarchivist_uring_tell(tarchivist_t *tar) {
+    const tarchivist_uring_t *uring = tar->stream;
+    return uring->pos;
+}
 
-    if (tar == NULL) {
-        return TARCHIVIST_FAILURE;
-    }
+/* Keeps all the free slots reading the data following the one already requested */
+static int tarchivist_uring_read_ahead(tarchivist_uring_t *uring) {
+    tarchivist_uring_slot_t *slot;
+    unsigned i;
 
-    /* Read header */
-    err = tarchivist_read_header(tar, &header);
-    if (err != TARCHIVIST_SUCCESS) {
-        return err;
+    for (i = 0; i < TARCHIVIST_URING_DEPTH; ++i) {
+        slot = &uring->slots[i];
+        /* Data left behind is not going to be needed */
+        if (slot->state == TARCHIVIST_SLOT_READY && slot->offset + slot->length <= uring->pos) {
+            slot->state = TARCHIVIST_SLOT_FREE;
+        }
+        if (slot->state == TARCHIVIST_SLOT_FREE) {
+            slot->offset = uring->ahead;
+            slot->length = 0;
+            tarchivist_uring_queue(uring, i, TARCHIVIST_SLOT_READING);
+            uring->ahead += TARCHIVIST_URING_SLOT_SIZE;
+        }
     }
+    return tarchivist_uring_enter(uring, false);
+}
 
-    /* Compute record size */
-    record_size = tarchivist_round_up(header.size, TARCHIVIST_TAR_BLOCK_SIZE) + sizeof(tarchivist_raw_header_t);
-    return tar->seek(tar, tar->tell(tar) + record_size, TARCHIVIST_SEEK_SET);
+static int tarchivist_uring_pread(tarchivist_t *tar, int64_t offset, unsigned size, void *data) {
+    const tarchivist_uring_t *uring = tar->stream;
+    return tarchivist_pread_fd(uring->fd, data, size, offset) ? TARCHIVIST_SUCCESS : TARCHIVIST_READFAIL;
 }
 
-int tarchivist_find(tarchivist_t *tar, const char *path, tarchivist_header_t *header) {
-    unsigned prefix_length, name_length, path_length;
-    const char *name;
+static int tarchivist_uring_read(tarchivist_t *tar, unsigned size, void *data) {
+    tarchivist_uring_t *uring = tar->stream;
+    tarchivist_uring_slot_t *slot;
+    uint8_t *bytes = data;
+    unsigned chunk_size, i;
     int err;
 
-    if (tar == NULL || path == NULL || header == NULL) {
-        return TARCHIVIST_FAILURE;
+    if (uring->err != TARCHIVIST_SUCCESS) {
+        return uring->err;
     }
-
-    /* Search from the beginning of the archive */
-    err = tarchivist_rewind(tar);
-    if (err != TARCHIVIST_SUCCESS) {
-        return err;
+    /* Reading after writing starts from scratch */
+    if (uring->writing) {
+        err = tarchivist_uring_drain(uring);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+    }
+
+    while (size > 0) {
+        slot = NULL;
+        for (i = 0; i < TARCHIVIST_URING_DEPTH; ++i) {
+            if ((uring->slots[i].state == TARCHIVIST_SLOT_READING || uring->slots[i].state == TARCHIVIST_SLOT_READY) &&
+                uring->slots[i].offset <= uring->pos && uring->pos < uring->slots[i].offset + TARCHIVIST_URING_SLOT_SIZE) {
+                slot = &uring->slots[i];
+                break;
+            }
+        }
+
+        /* Position outside of the read-ahead window, e.g. after a seek */
+        if (slot == NULL) {
+            err = tarchivist_uring_drain(uring);
+            if (err == TARCHIVIST_SUCCESS) {
+                err = tarchivist_uring_read_ahead(uring);
+            }
+            if (err != TARCHIVIST_SUCCESS) {
+                return err;
+            }
+            continue;
+        }
+        if (slot->state == TARCHIVIST_SLOT_READING) {
+            err = tarchivist_uring_enter(uring, true);
+            if (err != TARCHIVIST_SUCCESS) {
+                return err;
+            }
+            continue;
+        }
+        if (uring->pos >= slot->offset + slot->length) {
+            return TARCHIVIST_READFAIL; /* End of file */
+        }
+
+        chunk_size = (unsigned)(slot->offset + slot->length - uring->pos);
+        if (chunk_size > size) {
+            chunk_size = size;
+        }
+        memcpy(bytes, slot->data + (uring->pos - slot->offset), chunk_size);
+        uring->pos += chunk_size;
+        bytes += chunk_size;
+        size -= chunk_size;
+
+        /* Slot used up, put it back to work */
+        if (uring->pos == slot->offset + TARCHIVIST_URING_SLOT_SIZE) {
+            err = tarchivist_uring_read_ahead(uring);
+            if (err != TARCHIVIST_SUCCESS) {
+                return err;
+            }
+        }
+    }
+
+    return TARCHIVIST_SUCCESS;
+}
+
+static int tarchivist_uring_write(tarchivist_t *tar, unsigned size, const void *data) {
+    tarchivist_uring_t *uring = tar->stream;
+    tarchivist_uring_slot_t *slot;
+    const uint8_t *bytes = data;
+    unsigned chunk_size, i;
+    int err;
+
+    if (uring->err != TARCHIVIST_SUCCESS) {
+        return uring->err;
+    }
+    /* Data read ahead becomes stale */
+    if (!uring->writing) {
+        err = tarchivist_uring_drain(uring);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+        uring->writing = true;
+    }
+
+    while (size > 0) {
+        if (uring->filling < 0) {
+            for (i = 0; i < TARCHIVIST_URING_DEPTH; ++i) {
+                if (uring->slots[i].state == TARCHIVIST_SLOT_FREE) {
+                    break;
+                }
+            }
+            /* All the slots are busy, so submit whatever is queued and wait for one of them */
+            if (i == TARCHIVIST_URING_DEPTH) {
+                err = tarchivist_uring_enter(uring, true);
+                if (err != TARCHIVIST_SUCCESS) {
+                    return err;
+                }
+                continue;
+            }
+            slot = &uring->slots[i];
+            slot->offset = uring->pos;
+            slot->length = 0;
+            slot->done = 0;
+            slot->state = TARCHIVIST_SLOT_FILLING;
+            uring->filling = (int)i;
+        }
+        slot = &uring->slots[uring->filling];
+
+        chunk_size = TARCHIVIST_URING_SLOT_SIZE - slot->length;
+        if (chunk_size > size) {
+            chunk_size = size;
+        }
+        memcpy(slot->data + slot->length, bytes, chunk_size);
+        slot->length += chunk_size;
+        uring->pos += chunk_size;
+        bytes += chunk_size;
+        size -= chunk_size;
+
+        if (slot->length == TARCHIVIST_URING_SLOT_SIZE) {
+            tarchivist_uring_queue(uring, (unsigned)uring->filling, TARCHIVIST_SLOT_WRITING);
+            uring->filling = -1;
+        }
+    }
+
+    return TARCHIVIST_SUCCESS;
+}
+
+static int tarchivist_uring_close(tarchivist_t *tar) {
+    tarchivist_uring_t *uring = tar->stream;
+    int err = tarchivist_uring_drain(uring);
+    tarchivist_uring_teardown(uring);
+    return (err == TARCHIVIST_SUCCESS) ? TARCHIVIST_SUCCESS : TARCHIVIST_CLOSEFAIL;
+}
+
+/* Opens the file with the io_uring backend. TARCHIVIST_NOTSUPPORTED means that the ring could not be set up
+ * (old kernel, system policy, locked memory limit or no memory for it), so the caller falls back to stdio */
+static int tarchivist_uring_open(tarchivist_t *tar, const char *filename, int flags) {
+    tarchivist_uring_t *uring;
+    unsigned i;
+    int err;
+
+    uring = calloc(1, sizeof(tarchivist_uring_t));
+    if (uring == NULL) {
+        return TARCHIVIST_NOTSUPPORTED;
+    }
+    uring->fd = -1;
+    uring->filling = -1;
+
+    err = tarchivist_uring_setup(uring);
+    if (err == TARCHIVIST_SUCCESS) {
+        uring->memory = malloc(TARCHIVIST_URING_DEPTH * TARCHIVIST_URING_SLOT_SIZE);
+        err = (uring->memory != NULL) ? TARCHIVIST_SUCCESS : TARCHIVIST_NOTSUPPORTED;
+    }
+    if (err == TARCHIVIST_SUCCESS) {
+        uring->fd = open(filename, flags, 0666);
+        err = (uring->fd >= 0) ? TARCHIVIST_SUCCESS : TARCHIVIST_OPENFAIL;
+    }
+    if (err != TARCHIVIST_SUCCESS) {
+        tarchivist_uring_teardown(uring);
+        return err;
+    }
+
+    for (i = 0; i < TARCHIVIST_URING_DEPTH; ++i) {
+        uring->slots[i].data = uring->memory + i * TARCHIVIST_URING_SLOT_SIZE;
+    }
+
+    tar->seek = tarchivist_uring_seek;
+    tar->tell = tarchivist_uring_tell;
+    tar->read = tarchivist_uring_read;
+    tar->write = tarchivist_uring_write;
+    tar->close = tarchivist_uring_close;
+    tar->pread = tarchivist_uring_pread;
+    tar->stream = uring;
+    return TARCHIVIST_SUCCESS;
+}
+#endif
+
+/* Opens the file through stdio, or with the io_uring backend if requested. If the ring cannot be set up
+ * at run time, stdio is used instead; a build without the backend rejects the request */
+static int tarchivist_file_open(tarchivist_t *tar, const char *filename, const char *mode, bool use_uring) {
+#ifdef TARCHIVIST_URING_BACKEND
+    int flags;
+    int err;
+
+    if (use_uring) {
+        flags = (mode[0] == 'w') ? (O_WRONLY | O_CREAT | O_TRUNC) : (mode[1] == '+' || mode[2] == '+') ? O_RDWR : O_RDONLY;
+        err = tarchivist_uring_open(tar, filename, flags);
+        if (err != TARCHIVIST_NOTSUPPORTED) {
+            return err;
+        }
+    }
+#else
+    if (use_uring) {
+        return TARCHIVIST_NOTSUPPORTED;
+    }
+#endif
+    tar->stream = fopen(filename, mode);
+    return (tar->stream != NULL) ? TARCHIVIST_SUCCESS : TARCHIVIST_OPENFAIL;
+}
+
+static int tarchivist_buffer_alloc(tarchivist_t *tar) {
+    void *buffer;
+
+    if (tar->buffer_size == 0) {
+        tar->buffer_size = TARCHIVIST_DEFAULT_BUFFER_SIZE;
+    }
+    if (tar->allocator != NULL) {
+        buffer = tar->allocator->alloc(tar->allocator->ctx, tar->buffer_size);
+    }
+    else {
+#ifdef TARCHIVIST_POSIX
+        if (posix_memalign(&buffer, TARCHIVIST_BUFFER_ALIGNMENT, tar->buffer_size) != 0) {
+            buffer = NULL;
+        }
+#else
+        buffer = malloc(tar->buffer_size);
+#endif
+    }
+    if (buffer == NULL) {
+        return TARCHIVIST_NOMEMORY;
+    }
+
+    tar->buffer = buffer;
+    tar->buffer_used = 0;
+    return TARCHIVIST_SUCCESS;
+}
+
+/* All the writes go through the write-back buffer, which is passed to the stream only when full,
+ * so that the stream gets large writes of the same size. Data spanning whole buffers bypasses it */
+static int tarchivist_write_buffered(tarchivist_t *tar, unsigned size, const void *data) {
+    const uint8_t *bytes = data;
+    unsigned chunk_size;
+    int err;
+
+    if (tar->unbuffered) {
+        err = tar->write(tar, size, data);
+        if (err == TARCHIVIST_SUCCESS) {
+            tar->pos += size;
+            tarchivist_cache_release(tar, tar->pos, false);
+        }
+        return err;
+    }
+    if (tar->buffer == NULL) {
+        err = tarchivist_buffer_alloc(tar);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+    }
+
+    while (size > 0) {
+        if (tar->buffer_used == 0 && size >= tar->buffer_size) {
+            chunk_size = size - size % tar->buffer_size;
+            err = tar->write(tar, chunk_size, bytes);
+        }
+        else {
+            chunk_size = tar->buffer_size - tar->buffer_used;
+            if (chunk_size > size) {
+                chunk_size = size;
+            }
+            memcpy(tar->buffer + tar->buffer_used, bytes, chunk_size);
+            tar->buffer_used += chunk_size;
+
+            err = TARCHIVIST_SUCCESS;
+            if (tar->buffer_used == tar->buffer_size) {
+                err = tar->write(tar, tar->buffer_size, tar->buffer);
+                tar->buffer_used = 0;
+            }
+        }
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+
+        bytes += chunk_size;
+        size -= chunk_size;
+        tar->pos += chunk_size;
+    }
+
+    tarchivist_cache_release(tar, tar->pos - tar->buffer_used, false); /* Buffered data hasn't reached the stream yet */
+    return TARCHIVIST_SUCCESS;
+}
+
+/* Stream over an archive image in memory */
+typedef struct tarchivist_mem_t {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+} tarchivist_mem_t;
+
+static int tarchivist_mem_seek(tarchivist_t *tar, int64_t offset, int whence) {
+    tarchivist_mem_t *mem = tar->stream;
+    int64_t pos;
+
+    switch (whence) {
+        case TARCHIVIST_SEEK_SET:
+            pos = offset;
+            break;
+        case TARCHIVIST_SEEK_END:
+            pos = (int64_t)mem->size + offset;
+            break;
+        default:
+            return TARCHIVIST_SEEKFAIL;
+    }
+
+    if (pos < 0 || (uint64_t)pos > mem->size) {
+        return TARCHIVIST_SEEKFAIL;
+    }
+    mem->pos = (size_t)pos;
+    return TARCHIVIST_SUCCESS;
+}
+
+static int64_t tarchivist_mem_tell(tarchivist_t *tar) {
+    const tarchivist_mem_t *mem = tar->stream;
+    return (int64_t)mem->pos;
+}
+
+static int tarchivist_mem_read(tarchivist_t *tar, unsigned size, void *data) {
+    tarchivist_mem_t *mem = tar->stream;
+
+    if (mem->size - mem->pos < size) {
+        return TARCHIVIST_READFAIL;
+    }
+    memcpy(data, mem->data + mem->pos, size);
+    mem->pos += size;
+    return TARCHIVIST_SUCCESS;
+}
+
+static int tarchivist_mem_pread(tarchivist_t *tar, int64_t offset, unsigned size, void *data) {
+    const tarchivist_mem_t *mem = tar->stream;
+
+    if (offset < 0 || (uint64_t)offset > mem->size || mem->size - (size_t)offset < size) {
+        return TARCHIVIST_READFAIL;
+    }
+    memcpy(data, mem->data + offset, size);
+    return TARCHIVIST_SUCCESS;
+}
+
+static int tarchivist_mem_write_readonly(tarchivist_t *tar, unsigned size, const void *data) {
+    (void)tar;
+    (void)size;
+    (void)data;
+    return TARCHIVIST_WRITEFAIL;
+}
+
+static int tarchivist_mem_close(tarchivist_t *tar) {
+    free(tar->stream);
+    tar->stream = NULL;
+    tar->map = NULL;
+    return TARCHIVIST_SUCCESS;
+}
+
+/* Data is never moved, so a new chunk is chained at the end */
+static tarchivist_mem_chunk_t *tarchivist_membuf_grow(tarchivist_membuf_t *membuf) {
+    const size_t capacity = (membuf->chunk_size > 0) ? membuf->chunk_size : TARCHIVIST_MEM_CHUNK_SIZE;
+    tarchivist_mem_chunk_t *chunk;
+
+    chunk = malloc(sizeof(tarchivist_mem_chunk_t) + capacity);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->size = 0;
+    chunk->capacity = capacity;
+    chunk->data = (uint8_t *)(chunk + 1);
+
+    if (membuf->tail != NULL) {
+        membuf->tail->next = chunk;
+    }
+    else {
+        membuf->head = chunk;
+    }
+    membuf->tail = chunk;
+    membuf->chunk_size = (capacity < TARCHIVIST_MEM_CHUNK_SIZE_MAX / 2) ? (2 * capacity) : TARCHIVIST_MEM_CHUNK_SIZE_MAX;
+
+    return chunk;
+}
+
+static int tarchivist_membuf_append(tarchivist_membuf_t *membuf, size_t size, const void *data) {
+    const uint8_t *bytes = data;
+    tarchivist_mem_chunk_t *chunk = membuf->tail;
+    size_t chunk_size;
+
+    while (size > 0) {
+        if (chunk == NULL || chunk->size == chunk->capacity) {
+            chunk = tarchivist_membuf_grow(membuf);
+            if (chunk == NULL) {
+                return TARCHIVIST_NOMEMORY;
+            }
+        }
+        chunk_size = chunk->capacity - chunk->size;
+        if (chunk_size > size) {
+            chunk_size = size;
+        }
+        memcpy(chunk->data + chunk->size, bytes, chunk_size);
+        chunk->size += chunk_size;
+        membuf->size += chunk_size;
+        bytes += chunk_size;
+        size -= chunk_size;
+    }
+
+    return TARCHIVIST_SUCCESS;
+}
+
+/* Archive is only ever appended to, seeking makes sense just to the end */
+static int tarchivist_membuf_seek(tarchivist_t *tar, int64_t offset, int whence) {
+    const tarchivist_membuf_t *membuf = tar->stream;
+    const int64_t pos = (whence == TARCHIVIST_SEEK_END) ? ((int64_t)membuf->size + offset) : offset;
+
+    if ((whence != TARCHIVIST_SEEK_SET && whence != TARCHIVIST_SEEK_END) || pos != (int64_t)membuf->size) {
+        return TARCHIVIST_SEEKFAIL;
+    }
+    return TARCHIVIST_SUCCESS;
+}
+
+static int64_t tarchivist_membuf_tell(tarchivist_t *tar) {
+    const tarchivist_membuf_t *membuf = tar->stream;
+    return (int64_t)membuf->size;
+}
+
+static int tarchivist_membuf_read_writeonly(tarchivist_t *tar, unsigned size, void *data) {
+    (void)tar;
+    (void)size;
+    (void)data;
+    return TARCHIVIST_READFAIL;
+}
+
+static int tarchivist_membuf_write(tarchivist_t *tar, unsigned size, const void *data) {
+    return tarchivist_membuf_append(tar->stream, size, data);
+}
+
+/* Chunks belong to the caller and outlive the archive */
+static int tarchivist_membuf_close(tarchivist_t *tar) {
+    tar->stream = NULL;
+    return TARCHIVIST_SUCCESS;
+}
+
+#ifdef TARCHIVIST_POSIX
+static int tarchivist_map_close(tarchivist_t *tar) {
+    tarchivist_mem_t *mem = tar->stream;
+    const int err = munmap((void *)mem->data, mem->size);
+
+    free(mem);
+    tar->stream = NULL;
+    tar->map = NULL;
+    return (err == 0) ? TARCHIVIST_SUCCESS : TARCHIVIST_CLOSEFAIL;
+}
+
+static int tarchivist_map_open(tarchivist_t *tar, const char *filename) {
+    tarchivist_mem_t *mem;
+    struct stat statbuf;
+    void *map;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return TARCHIVIST_OPENFAIL;
+    }
+    if (fstat(fd, &statbuf) != 0 || statbuf.st_size <= 0 || (uint64_t)statbuf.st_size > SIZE_MAX) {
+        close(fd);
+        return TARCHIVIST_OPENFAIL;
+    }
+
+    /* Mapping stays valid after the descriptor is closed */
+    map = mmap(NULL, (size_t)statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return TARCHIVIST_OPENFAIL;
+    }
+
+    mem = malloc(sizeof(tarchivist_mem_t));
+    if (mem == NULL) {
+        munmap(map, (size_t)statbuf.st_size);
+        return TARCHIVIST_NOMEMORY;
+    }
+    mem->data = map;
+    mem->size = (size_t)statbuf.st_size;
+    mem->pos = 0;
+
+    tar->seek = tarchivist_mem_seek;
+    tar->tell = tarchivist_mem_tell;
+    tar->read = tarchivist_mem_read;
+    tar->write = tarchivist_mem_write_readonly;
+    tar->close = tarchivist_map_close;
+    tar->pread = tarchivist_mem_pread;
+    tar->stream = mem;
+    tar->map = mem->data;
+    tar->map_size = mem->size;
+
+    return TARCHIVIST_SUCCESS;
+}
+#else
+/* Without mmap the archive is read through stdio */
+static int tarchivist_map_open(tarchivist_t *tar, const char *filename) {
+    tar->stream = fopen(filename, "rb");
+    return (tar->stream != NULL) ? TARCHIVIST_SUCCESS : TARCHIVIST_OPENFAIL;
+}
+#endif
+
+static int tarchivist_rewind(tarchivist_t *tar) {
+    /* Forward-only stream cannot go back */
+    if (tar->sequential) {
+        return TARCHIVIST_NOTSUPPORTED;
+    }
+
+    tar->last_header_pos = 0;
+    tar->bytes_left = 0;
+    tar->entry = NULL;
+    return tar->seek(tar, 0, TARCHIVIST_SEEK_SET);
+}
+
+/* Moves the forward-only stream ahead by reading and dropping the data */
+static int tarchivist_discard(tarchivist_t *tar, uint64_t size) {
+    uint8_t buffer[TARCHIVIST_DISCARD_BUFFER_SIZE];
+    unsigned chunk_size;
+    int err;
+
+    while (size > 0) {
+        chunk_size = (size < sizeof(buffer)) ? (unsigned)size : sizeof(buffer);
+        err = tar->read(tar, chunk_size, buffer);
+        if (err != TARCHIVIST_SUCCESS) {
+            tar->pos = -1; /* Position unknown after failed read */
+            return err;
+        }
+        tar->pos += chunk_size;
+        size -= chunk_size;
+    }
+
+    return TARCHIVIST_SUCCESS;
+}
+
+/* Position is tracked for the forward-only stream. Otherwise it belongs to the writer, so after a read
+ * it's taken from the stream, wherever the read has left it */
+static void tarchivist_track_pos(tarchivist_t *tar, int64_t pos) {
+    if (tar->sequential) {
+        tar->pos = pos;
+    }
+    else if (tar->finalize) {
+        tar->pos = tar->tell(tar);
+    }
+}
+
+/* Gets the stream from one position to another, forward-only stream can only skip ahead */
+static int tarchivist_move(tarchivist_t *tar, int64_t from, int64_t to) {
+    if (tar->sequential) {
+        if (from < 0 || to < from) {
+            return TARCHIVIST_SEEKFAIL;
+        }
+        tar->pos = from;
+        return tarchivist_discard(tar, (uint64_t)(to - from));
+    }
+    return tar->seek(tar, to, TARCHIVIST_SEEK_SET);
+}
+
+static int tarchivist_check_raw_header(const tarchivist_raw_header_t *raw_header) {
+    /* Assume that checksum starting with a null byte indicates a null record */
+    if (raw_header->checksum[0] == '\0') {
+        return TARCHIVIST_NULLRECORD;
+    }
+
+    if (tarchivist_validate_checksum(raw_header) != TARCHIVIST_SUCCESS) {
+        return TARCHIVIST_BADCHKSUM;
+    }
+    return TARCHIVIST_SUCCESS;
+}
+
+/* Parses and loads raw header, already checked, to header */
+static void tarchivist_decode_raw_header(tarchivist_header_t *header, const tarchivist_raw_header_t *raw_header) {
+    memcpy(header->name, raw_header->name, sizeof(header->name));
+    header->mode = tarchivist_parse_octal(raw_header->mode, sizeof(raw_header->mode));
+    header->uid = tarchivist_parse_octal(raw_header->uid, sizeof(raw_header->uid));
+    header->gid = tarchivist_parse_octal(raw_header->gid, sizeof(raw_header->gid));
+    header->size = tarchivist_parse_octal(raw_header->size, sizeof(raw_header->size));
+    header->mtime = tarchivist_parse_octal(raw_header->mtime, sizeof(raw_header->mtime));
+    header->typeflag = raw_header->typeflag;
+    memcpy(header->linkname, raw_header->linkname, sizeof(header->linkname));
+    memcpy(header->uname, raw_header->uname, sizeof(header->uname));
+    memcpy(header->gname, raw_header->gname, sizeof(header->gname));
+    header->devmajor = tarchivist_parse_octal(raw_header->devmajor, sizeof(raw_header->devmajor));
+    header->devminor = tarchivist_parse_octal(raw_header->devminor, sizeof(raw_header->devminor));
+    memcpy(header->prefix, raw_header->prefix, sizeof(header->prefix));
+}
+
+static int tarchivist_raw_to_header(tarchivist_header_t *header, const tarchivist_raw_header_t *raw_header) {
+    const int err = tarchivist_check_raw_header(raw_header);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    tarchivist_decode_raw_header(header, raw_header);
+    return TARCHIVIST_SUCCESS;
+}
+
+static void tarchivist_store_checksum(tarchivist_raw_header_t *raw_header, unsigned checksum) {
+    /* Six digits, null-terminator and space */
+    tarchivist_format_octal(raw_header->checksum, sizeof(raw_header->checksum) - 1, checksum);
+    raw_header->checksum[7] = ' ';
+}
+
+static int tarchivist_header_to_raw(tarchivist_raw_header_t *raw_header, const tarchivist_header_t *header) {
+    unsigned checksum;
+
+    /* Clear header */
+    memset(raw_header, 0, sizeof(tarchivist_raw_header_t));
+
+    /* Parse and load header to raw header */
+    memcpy(raw_header->name, header->name, sizeof(raw_header->name));
+    tarchivist_format_octal(raw_header->mode, sizeof(raw_header->mode), header->mode);
+    tarchivist_format_octal(raw_header->uid, sizeof(raw_header->uid), header->uid);
+    tarchivist_format_octal(raw_header->gid, sizeof(raw_header->gid), header->gid);
+    tarchivist_format_size(raw_header->size, sizeof(raw_header->size), header->size);
+    tarchivist_format_octal(raw_header->mtime, sizeof(raw_header->mtime), header->mtime);
+    raw_header->typeflag = header->typeflag;
+    memcpy(raw_header->linkname, header->linkname, sizeof(raw_header->linkname));
+    memcpy(raw_header->magic, TARCHIVIST_MAGIC, sizeof(raw_header->magic));
+    memcpy(raw_header->version, TARCHIVIST_VERSION, sizeof(raw_header->version));
+    memcpy(raw_header->uname, header->uname, sizeof(raw_header->uname));
+    memcpy(raw_header->gname, header->gname, sizeof(raw_header->gname));
+    tarchivist_format_octal(raw_header->devmajor, sizeof(raw_header->devmajor), header->devmajor);
+    tarchivist_format_octal(raw_header->devminor, sizeof(raw_header->devminor), header->devminor);
+    memcpy(raw_header->prefix, header->prefix, sizeof(raw_header->prefix));
+
+    /* Compute checksum */
+    checksum = tarchivist_compute_checksum(raw_header);
+    tarchivist_store_checksum(raw_header, checksum);
+
+    return TARCHIVIST_SUCCESS;
+}
+
+static unsigned tarchivist_field_length(const char *field, unsigned size) {
+    const char *end = memchr(field, '\0', size);
+    return (end != NULL) ? (unsigned)(end - field) : size;
+}
+
+static unsigned tarchivist_full_path(char *path, const char *prefix, const char *name) {
+    const unsigned prefix_length = tarchivist_field_length(prefix, TARCHIVIST_PREFIX_SIZE);
+    const unsigned name_length = tarchivist_field_length(name, TARCHIVIST_NAME_SIZE);
+    unsigned length = 0;
+
+    /* Path is stored as prefix and name separated by a slash, prefix is optional */
+    if (prefix_length > 0) {
+        memcpy(path, prefix, prefix_length);
+        length = prefix_length;
+        path[length++] = '/';
+    }
+    memcpy(path + length, name, name_length);
+    length += name_length;
+    path[length] = '\0';
+
+    return length;
+}
+
+/* FNV-1a */
+static unsigned tarchivist_hash_update(unsigned hash, const char *data, unsigned length) {
+    unsigned i;
+
+    for (i = 0; i < length; ++i) {
+        hash ^= (uint8_t)data[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+static unsigned tarchivist_hash(const char *data, unsigned length) {
+    return tarchivist_hash_update(2166136261U, data, length);
+}
+
+/* Reads the raw header from the stream positioned at pos. If the archive is mapped,
+ * the header is taken straight from the mapping and the stream is not touched at all */
+static int tarchivist_fetch_raw_header(tarchivist_t *tar, int64_t pos, tarchivist_raw_header_t *storage, const tarchivist_raw_header_t **raw_header) {
+    if (tar->map != NULL) {
+        if (pos < 0 || (uint64_t)pos > tar->map_size || tar->map_size - (size_t)pos < sizeof(tarchivist_raw_header_t)) {
+            return TARCHIVIST_READFAIL;
+        }
+        *raw_header = (const tarchivist_raw_header_t *)((const uint8_t *)tar->map + pos);
+        return TARCHIVIST_SUCCESS;
+    }
+
+    *raw_header = storage;
+    return tar->read(tar, sizeof(tarchivist_raw_header_t), storage);
+}
+
+/* Index trailer written by tarchivist_close is not a part of the archive content */
+static bool tarchivist_is_trailer(const tarchivist_raw_header_t *raw_header) {
+    return raw_header->typeflag == TARCHIVIST_FILE && raw_header->prefix[0] == '\0' &&
+           strncmp(raw_header->name, TARCHIVIST_TRAILER_NAME, sizeof(raw_header->name)) == 0;
+}
+
+/* Fetches and checks the header at pos, moving pos past it. Global extended headers are skipped along with their data,
+ * their records apply to the whole archive and carry nothing the library uses. So is the index trailer */
+static int tarchivist_fetch_member_header(tarchivist_t *tar, int64_t *pos, tarchivist_raw_header_t *storage, const tarchivist_raw_header_t **raw_header) {
+    uint64_t skip;
+    int err;
+
+    for (;;) {
+        err = tarchivist_fetch_raw_header(tar, *pos, storage, raw_header);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+        err = tarchivist_check_raw_header(*raw_header);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+        *pos += sizeof(tarchivist_raw_header_t);
+        if ((*raw_header)->typeflag != TARCHIVIST_GLOBAL && !tarchivist_is_trailer(*raw_header)) {
+            return TARCHIVIST_SUCCESS;
+        }
+
+        skip = tarchivist_round_up(tarchivist_parse_octal((*raw_header)->size, sizeof((*raw_header)->size)), TARCHIVIST_TAR_BLOCK_SIZE);
+        *pos += (int64_t)skip;
+        if (tar->map == NULL && !tar->sequential && skip > 0) {
+            err = tar->seek(tar, *pos, TARCHIVIST_SEEK_SET);
+            if (err != TARCHIVIST_SUCCESS) {
+                return err;
+            }
+            continue;
+        }
+        /* Storage is free to be used as scratch, the next header overwrites it anyway */
+        for (; tar->map == NULL && skip > 0; skip -= TARCHIVIST_TAR_BLOCK_SIZE) {
+            err = tar->read(tar, sizeof(tarchivist_raw_header_t), storage);
+            if (err != TARCHIVIST_SUCCESS) {
+                return err;
+            }
+        }
+    }
+}
+
+/* Parses decimal number of at most length characters, returns the number of characters consumed */
+static unsigned tarchivist_parse_decimal(const char *data, unsigned length, uint64_t *value) {
+    unsigned digit;
+    unsigned i;
+
+    *value = 0;
+    for (i = 0; i < length; ++i) {
+        digit = (unsigned)(uint8_t)data[i] - '0';
+        if (digit > 9) {
+            break;
+        }
+        *value = *value * 10 + digit;
+    }
+
+    return i;
+}
+
+static unsigned tarchivist_format_decimal(char *data, uint64_t value) {
+    char digits[20];
+    unsigned length = 0;
+    unsigned i;
+
+    do {
+        digits[length++] = (char)('0' + (value % 10));
+        value /= 10;
+    } while (value > 0);
+
+    for (i = 0; i < length; ++i) {
+        data[i] = digits[length - i - 1];
+    }
+
+    return length;
+}
+
+/* Looks for the size record among "length key=value\n" records of the extended header */
+static int tarchivist_pax_parse(const char *data, uint64_t length, uint64_t *size, bool *has_size) {
+    const char *const end = data + length;
+    uint64_t record_length;
+    unsigned digits;
+
+    while (data < end && *data != '\0') {
+        digits = tarchivist_parse_decimal(data, (unsigned)(end - data), &record_length);
+        if (digits == 0 || data[digits] != ' ' || record_length <= digits || record_length > (uint64_t)(end - data)) {
+            return TARCHIVIST_BADCHKSUM;
+        }
+
+        if (record_length > digits + 6 && memcmp(data + digits, " size=", 6) == 0) {
+            tarchivist_parse_decimal(data + digits + 6, (unsigned)record_length - digits - 6, size);
+            *has_size = true;
+        }
+        data += record_length;
+    }
+
+    return TARCHIVIST_SUCCESS;
+}
+
+/* Reads the member starting at pos, following the PAX extended header if there is one, without decoding the header;
+ * size is taken from the extended header if present. Unless the archive is mapped, the stream has to be at pos and is left
+ * at the member's data. Raw header is either in the storage or in the mapping */
+static int tarchivist_read_raw_member(tarchivist_t *tar, int64_t pos, tarchivist_raw_header_t *storage, const tarchivist_raw_header_t **raw_header, uint64_t *size, int64_t *data_pos) {
+    char buffer[TARCHIVIST_PAX_BUFFER_SIZE];
+    const char *pax_data;
+    char *pax_storage = NULL;
+    uint64_t pax_size, pax_length, pax_value = 0;
+    bool has_size = false;
+    int err;
+
+    err = tarchivist_fetch_member_header(tar, &pos, storage, raw_header);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    *size = tarchivist_parse_octal((*raw_header)->size, sizeof((*raw_header)->size));
+
+    if ((*raw_header)->typeflag == TARCHIVIST_PAX) {
+        pax_length = *size;
+        pax_size = tarchivist_round_up(pax_length, TARCHIVIST_TAR_BLOCK_SIZE);
+        if (pax_size > TARCHIVIST_PAX_SIZE_MAX) {
+            return TARCHIVIST_NOTSUPPORTED;
+        }
+
+        /* Extended header data comes right before the real header */
+        if (tar->map != NULL) {
+            if ((uint64_t)pos > tar->map_size || tar->map_size - (size_t)pos < pax_size) {
+                return TARCHIVIST_READFAIL;
+            }
+            pax_data = (const char *)tar->map + pos;
+        }
+        else {
+            if (pax_size > sizeof(buffer)) {
+                pax_storage = tarchivist_alloc(tar->allocator, pax_size);
+                if (pax_storage == NULL) {
+                    return TARCHIVIST_NOMEMORY;
+                }
+            }
+            pax_data = (pax_storage != NULL) ? pax_storage : buffer;
+            err = tar->read(tar, (unsigned)pax_size, (void *)pax_data);
+        }
+
+        if (err == TARCHIVIST_SUCCESS) {
+            err = tarchivist_pax_parse(pax_data, pax_length, &pax_value, &has_size);
+        }
+        tarchivist_release(tar->allocator, pax_storage, pax_size);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+        pos += pax_size;
+
+        err = tarchivist_fetch_member_header(tar, &pos, storage, raw_header);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+
+        /* Extended header takes precedence over the size field */
+        *size = has_size ? pax_value : tarchivist_parse_octal((*raw_header)->size, sizeof((*raw_header)->size));
+    }
+
+    *data_pos = pos;
+    return TARCHIVIST_SUCCESS;
+}
+
+/* Decoding counterpart of tarchivist_read_raw_member */
+static int tarchivist_read_member(tarchivist_t *tar, int64_t pos, tarchivist_header_t *header, int64_t *data_pos) {
+    tarchivist_raw_header_t storage;
+    const tarchivist_raw_header_t *raw_header;
+    uint64_t size;
+    int err;
+
+    err = tarchivist_read_raw_member(tar, pos, &storage, &raw_header, &size, data_pos);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    tarchivist_decode_raw_header(header, raw_header);
+    header->size = size;
+    return TARCHIVIST_SUCCESS;
+}
+
+static int tarchivist_read_header_at(tarchivist_t *tar, int64_t pos, tarchivist_header_t *header) {
+    int64_t data_pos = pos + sizeof(tarchivist_raw_header_t);
+    int read_status, seek_status = TARCHIVIST_SUCCESS;
+
+    /* Save last header position */
+    tar->last_header_pos = pos;
+
+    /* Read the header */
+    read_status = tarchivist_read_member(tar, pos, header, &data_pos);
+    tar->last_data_pos = data_pos;
+
+    /* Go back to the beginning of the header */
+    if (tar->map == NULL) {
+        seek_status = tar->seek(tar, pos, TARCHIVIST_SEEK_SET);
+    }
+
+    /* Report status */
+    if (read_status != TARCHIVIST_SUCCESS) {
+        return read_status;
+    }
+    return seek_status;
+}
+
+/* Forward-only counterpart of tarchivist_read_header_at. The header can be consumed from
+ * the stream only once, so it is kept until the stream moves past the member */
+static int tarchivist_read_header_sequential(tarchivist_t *tar, tarchivist_header_t *header) {
+    int64_t data_pos;
+    int err;
+
+    if (!tar->header_valid) {
+        if (tar->pos < 0) {
+            return TARCHIVIST_SEEKFAIL;
+        }
+
+        err = tarchivist_read_member(tar, tar->pos, &tar->header, &data_pos);
+        if (err != TARCHIVIST_SUCCESS) {
+            tar->pos = -1; /* Position unknown after failed read */
+            return err;
+        }
+        tar->last_header_pos = tar->pos;
+        tar->last_data_pos = data_pos;
+        tar->pos = data_pos;
+        tar->header_valid = true;
+    }
+
+    memcpy(header, &tar->header, sizeof(tarchivist_header_t));
+    return TARCHIVIST_SUCCESS;
+}
+
+static long tarchivist_read_data_sequential(tarchivist_t *tar, unsigned size, void *data) {
+    tarchivist_header_t header;
+    uint64_t data_left;
+    int err;
+
+    err = tarchivist_read_header_sequential(tar, &header);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    /* Data already consumed cannot be read again */
+    data_left = header.size - (uint64_t)(tar->pos - tar->last_data_pos);
+    if (data_left < size) {
+        size = (unsigned)data_left;
+    }
+
+    err = tar->read(tar, size, data);
+    if (err != TARCHIVIST_SUCCESS) {
+        tar->pos = -1;
+        return err;
+    }
+    tar->pos += size;
+    tar->bytes_left = data_left - size;
+
+    return size;
+}
+
+static const char *tarchivist_pool_store(tarchivist_index_t *index, const char *path, unsigned length) {
+    tarchivist_pool_block_t *block = index->pool;
+    char *stored;
+
+    /* Start a new block if the current one cannot fit the path */
+    if (block == NULL || block->used + length + 1 > sizeof(block->data)) {
+        block = tarchivist_alloc(index->allocator, sizeof(tarchivist_pool_block_t));
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = index->pool;
+        block->used = 0;
+        index->pool = block;
+    }
+
+    stored = block->data + block->used;
+    memcpy(stored, path, length + 1);
+    block->used += length + 1;
+
+    return stored;
+}
+
+static unsigned *tarchivist_index_bucket(const tarchivist_index_t *index, const char *path, unsigned length) {
+    const unsigned mask = index->bucket_count - 1;
+    unsigned i = tarchivist_hash(path, length) & mask;
+
+    /* Linear probing until either the path or an empty bucket is found */
+    while (index->buckets[i] != 0) {
+        if (strcmp(index->entries[index->buckets[i] - 1].path, path) == 0) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+
+    return &index->buckets[i];
+}
+
+static int tarchivist_index_grow(tarchivist_index_t *index) {
+    const unsigned capacity = (index->capacity > 0) ? (2 * index->capacity) : TARCHIVIST_INDEX_MIN_CAPACITY;
+    tarchivist_entry_t *entries;
+    unsigned *buckets;
+    unsigned i;
+
+    entries = tarchivist_resize(index->allocator, index->entries, index->capacity * sizeof(tarchivist_entry_t), capacity * sizeof(tarchivist_entry_t));
+    if (entries == NULL) {
+        return TARCHIVIST_NOMEMORY;
+    }
+    index->entries = entries;
+    index->capacity = capacity;
+
+    /* Keep the load factor at most 0.5 */
+    buckets = tarchivist_alloc(index->allocator, 2 * capacity * sizeof(unsigned));
+    if (buckets == NULL) {
+        return TARCHIVIST_NOMEMORY;
+    }
+    memset(buckets, 0, 2 * capacity * sizeof(unsigned));
+    tarchivist_release(index->allocator, index->buckets, index->bucket_count * sizeof(unsigned));
+    index->buckets = buckets;
+    index->bucket_count = 2 * capacity;
+
+    /* Rehash already stored entries */
+    for (i = 0; i < index->count; ++i) {
+        *tarchivist_index_bucket(index, entries[i].path, strlen(entries[i].path)) = i + 1;
+    }
+
+    return TARCHIVIST_SUCCESS;
+}
+
+static int tarchivist_index_insert(tarchivist_index_t *index, const char *path, unsigned length, const tarchivist_entry_t *values) {
+    tarchivist_entry_t *entry;
+    unsigned *bucket;
+    int err;
+
+    if (index->count == index->capacity) {
+        err = tarchivist_index_grow(index);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+    }
+
+    bucket = tarchivist_index_bucket(index, path, length);
+
+    /* If the path appears more than once, the last occurrence wins, just as in extraction */
+    if (*bucket != 0) {
+        entry = &index->entries[*bucket - 1];
+    }
+    else {
+        entry = &index->entries[index->count];
+        entry->path = tarchivist_pool_store(index, path, length);
+        if (entry->path == NULL) {
+            return TARCHIVIST_NOMEMORY;
+        }
+        *bucket = ++index->count;
+    }
+
+    entry->header_offset = values->header_offset;
+    entry->data_offset = values->data_offset;
+    entry->size = values->size;
+    entry->typeflag = values->typeflag;
+
+    return TARCHIVIST_SUCCESS;
+}
+
+static int tarchivist_index_insert_member(tarchivist_index_t *index, const char *prefix, const char *name, char typeflag, uint64_t size, int64_t header_pos, int64_t data_pos) {
+    char path[TARCHIVIST_PATH_MAX];
+    tarchivist_entry_t values;
+    unsigned length;
+
+    length = tarchivist_full_path(path, prefix, name);
+
+    /* Trailer is not a part of the archive content */
+    if (strcmp(path, TARCHIVIST_TRAILER_NAME) == 0) {
+        return TARCHIVIST_SUCCESS;
+    }
+
+    values.header_offset = header_pos;
+    values.data_offset = data_pos;
+    values.size = size;
+    values.typeflag = typeflag;
+
+    return tarchivist_index_insert(index, path, length, &values);
+}
+
+static void tarchivist_store_u64(uint8_t *data, uint64_t value) {
+    unsigned i;
+    for (i = 0; i < 8; ++i) {
+        data[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint64_t tarchivist_load_u64(const uint8_t *data) {
+    uint64_t value = 0;
+    unsigned i;
+    for (i = 0; i < 8; ++i) {
+        value |= (uint64_t)data[i] << (8 * i);
+    }
+    return value;
+}
+
+static int tarchivist_trailer_parse(tarchivist_index_t *index, const uint8_t *payload, uint64_t length, uint64_t count) {
+    const uint8_t *const end = payload + length;
+    char path[TARCHIVIST_PATH_MAX];
+    tarchivist_entry_t values;
+    unsigned path_length;
+    int err;
+
+    while (count-- > 0) {
+        if (end - payload < TARCHIVIST_TRAILER_RECORD_SIZE) {
+            return TARCHIVIST_NOTFOUND;
+        }
+
+        values.header_offset = (int64_t)tarchivist_load_u64(payload);
+        values.data_offset = (int64_t)tarchivist_load_u64(payload + 8);
+        values.size = tarchivist_load_u64(payload + 16);
+        values.typeflag = (char)payload[24];
+        path_length = payload[25] | (payload[26] << 8);
+        payload += TARCHIVIST_TRAILER_RECORD_SIZE;
+
+        if (path_length >= sizeof(path) || end - payload < path_length) {
+            return TARCHIVIST_NOTFOUND;
+        }
+        memcpy(path, payload, path_length);
+        path[path_length] = '\0';
+        payload += path_length;
+
+        err = tarchivist_index_insert(index, path, path_length, &values);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+    }
+
+    return TARCHIVIST_SUCCESS;
+}
+
+/* Checks that the last member recorded in the footer is still a valid member ending right where the trailer begins */
+static int tarchivist_trailer_check_last(tarchivist_t *tar, uint64_t last_pos, uint64_t trailer_pos) {
+    tarchivist_raw_header_t storage;
+    const tarchivist_raw_header_t *raw_header;
+    uint64_t size;
+    int64_t data_pos;
+    int err;
+
+    /* Trailer is the only member */
+    if (last_pos == trailer_pos) {
+        return TARCHIVIST_SUCCESS;
+    }
+    if (last_pos > trailer_pos) {
+        return TARCHIVIST_NOTFOUND;
+    }
+
+    err = tar->seek(tar, (int64_t)last_pos, TARCHIVIST_SEEK_SET);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    err = tarchivist_read_raw_member(tar, (int64_t)last_pos, &storage, &raw_header, &size, &data_pos);
+    if (err == TARCHIVIST_READFAIL || err == TARCHIVIST_BADCHKSUM || err == TARCHIVIST_NULLRECORD) {
+        return TARCHIVIST_NOTFOUND;
+    }
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    return ((uint64_t)data_pos + tarchivist_round_up(size, TARCHIVIST_TAR_BLOCK_SIZE) == trailer_pos) ? TARCHIVIST_SUCCESS : TARCHIVIST_NOTFOUND;
+}
+
+/* Looks for the index trailer written by tarchivist_close, returns TARCHIVIST_NOTFOUND if
+ * there is none or it does not match the archive. If index is not NULL, it gets filled */
+static int tarchivist_trailer_load(tarchivist_t *tar, int64_t size, tarchivist_index_t *index, int64_t *end_offset) {
+    tarchivist_raw_header_t raw_header;
+    tarchivist_header_t header;
+    uint8_t footer[TARCHIVIST_TAR_BLOCK_SIZE];
+    uint64_t trailer_pos, payload_length, count, offset;
+    uint8_t *payload;
+    unsigned hash, chunk_size;
+    int err;
+
+    if (size < TARCHIVIST_CLOSING_RECORD_SIZE + 2 * TARCHIVIST_TAR_BLOCK_SIZE) {
+        return TARCHIVIST_NOTFOUND;
+    }
+
+    /* Footer occupies the last block of the trailer data, right before the closing record */
+    err = tar->seek(tar, size - TARCHIVIST_CLOSING_RECORD_SIZE - TARCHIVIST_TAR_BLOCK_SIZE, TARCHIVIST_SEEK_SET);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    err = tar->read(tar, sizeof(footer), footer);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    /* Archive modified by another tool leaves a stale footer behind */
+    if (memcmp(footer, TARCHIVIST_TRAILER_MAGIC, sizeof(TARCHIVIST_TRAILER_MAGIC)) != 0 ||
+        tarchivist_load_u64(footer + 40) != (uint64_t)size) {
+        return TARCHIVIST_NOTFOUND;
+    }
+    count = tarchivist_load_u64(footer + 16);
+    payload_length = tarchivist_load_u64(footer + 24);
+    trailer_pos = tarchivist_load_u64(footer + 32);
+
+    /* Size and hash alone can match an archive rewritten by another tool, the last member has to be where it was */
+    err = tarchivist_trailer_check_last(tar, tarchivist_load_u64(footer + 56), trailer_pos);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    /* Validate the trailer header */
+    err = tar->seek(tar, (int64_t)trailer_pos, TARCHIVIST_SEEK_SET);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    err = tar->read(tar, sizeof(raw_header), &raw_header);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    if (tarchivist_raw_to_header(&header, &raw_header) != TARCHIVIST_SUCCESS ||
+        strncmp(header.name, TARCHIVIST_TRAILER_NAME, sizeof(header.name)) != 0 ||
+        trailer_pos + sizeof(raw_header) + header.size + TARCHIVIST_CLOSING_RECORD_SIZE != (uint64_t)size ||
+        header.size < sizeof(footer) || payload_length > header.size - sizeof(footer)) {
+        return TARCHIVIST_NOTFOUND;
+    }
+
+    if (index != NULL) {
+        if (payload_length >= SIZE_MAX) {
+            return TARCHIVIST_NOMEMORY;
+        }
+        payload = tarchivist_alloc(tar->allocator, (size_t)payload_length + 1);
+        if (payload == NULL) {
+            return TARCHIVIST_NOMEMORY;
+        }
+
+        /* Read and hashed in pieces, the payload of a huge index may not fit a single call */
+        hash = tarchivist_hash(NULL, 0);
+        for (offset = 0; offset < payload_length; offset += chunk_size) {
+            chunk_size = (payload_length - offset < TARCHIVIST_WRITE_CHUNK_SIZE) ? (unsigned)(payload_length - offset) : TARCHIVIST_WRITE_CHUNK_SIZE;
+            err = tar->read(tar, chunk_size, payload + offset);
+            if (err != TARCHIVIST_SUCCESS) {
+                break;
+            }
+            hash = tarchivist_hash_update(hash, (const char *)payload + offset, chunk_size);
+        }
+        if (err == TARCHIVIST_SUCCESS) {
+            err = (hash == (unsigned)tarchivist_load_u64(footer + 48))
+                ? tarchivist_trailer_parse(index, payload, payload_length, count)
+                : TARCHIVIST_NOTFOUND;
+        }
+        tarchivist_release(tar->allocator, payload, (size_t)payload_length + 1);
+
+        if (err != TARCHIVIST_SUCCESS) {
+            tarchivist_index_free(index);
+            return err;
+        }
+        index->end_offset = (int64_t)trailer_pos;
+    }
+
+    *end_offset = (int64_t)trailer_pos;
+    return TARCHIVIST_SUCCESS;
+}
+
+static int tarchivist_trailer_write(tarchivist_t *tar) {
+    const tarchivist_index_t *index = tar->index;
+    tarchivist_header_t header;
+    uint8_t buffer[TARCHIVIST_TAR_BLOCK_SIZE];
+    uint64_t payload_length = 0;
+    unsigned used = 0;
+    unsigned path_length, hash, padding, i;
+    int64_t pos, last_pos;
+    int err;
+
+    pos = tar->pos;
+
+    /* Header of the last member is recorded too, so that the loader can tell whether the archive is still the same */
+    last_pos = -1;
+    for (i = 0; i < index->count; ++i) {
+        payload_length += TARCHIVIST_TRAILER_RECORD_SIZE + strlen(index->entries[i].path);
+        if (index->entries[i].header_offset > last_pos) {
+            last_pos = index->entries[i].header_offset;
+        }
+    }
+
+    /* Trailer is an ordinary file, so that other tools still see a valid archive */
+    memset(&header, 0, sizeof(header));
+    strcpy(header.name, TARCHIVIST_TRAILER_NAME);
+    header.mode = 0444;
+    header.size = tarchivist_round_up(payload_length, TARCHIVIST_TAR_BLOCK_SIZE) + sizeof(buffer);
+    header.mtime = time(NULL);
+    header.typeflag = TARCHIVIST_FILE;
+
+    err = tarchivist_write_header(tar, &header);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    /* Records are staged in a single block, path is never longer than the block */
+    hash = tarchivist_hash(NULL, 0);
+    for (i = 0; i < index->count; ++i) {
+        path_length = strlen(index->entries[i].path);
+        if (used + TARCHIVIST_TRAILER_RECORD_SIZE + path_length > sizeof(buffer)) {
+            hash = tarchivist_hash_update(hash, (const char *)buffer, used);
+            err = tarchivist_write_buffered(tar, used, buffer);
+            if (err != TARCHIVIST_SUCCESS) {
+                return err;
+            }
+            used = 0;
+        }
+
+        tarchivist_store_u64(buffer + used, (uint64_t)index->entries[i].header_offset);
+        tarchivist_store_u64(buffer + used + 8, (uint64_t)index->entries[i].data_offset);
+        tarchivist_store_u64(buffer + used + 16, index->entries[i].size);
+        buffer[used + 24] = (uint8_t)index->entries[i].typeflag;
+        buffer[used + 25] = (uint8_t)path_length;
+        buffer[used + 26] = (uint8_t)(path_length >> 8);
+        memcpy(buffer + used + TARCHIVIST_TRAILER_RECORD_SIZE, index->entries[i].path, path_length);
+        used += TARCHIVIST_TRAILER_RECORD_SIZE + path_length;
+    }
+    hash = tarchivist_hash_update(hash, (const char *)buffer, used);
+    err = tarchivist_write_buffered(tar, used, buffer);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    /* Pad the records with zeros to the full block, the last staged ones may end anywhere within a block */
+    padding = (unsigned)(tarchivist_round_up(payload_length, TARCHIVIST_TAR_BLOCK_SIZE) - payload_length);
+    if (padding > 0) {
+        err = tarchivist_write_buffered(tar, padding, tarchivist_zero_block);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+    }
+
+    /* Footer */
+    memset(buffer, 0, sizeof(buffer));
+    memcpy(buffer, TARCHIVIST_TRAILER_MAGIC, sizeof(TARCHIVIST_TRAILER_MAGIC));
+    tarchivist_store_u64(buffer + 16, index->count);
+    tarchivist_store_u64(buffer + 24, payload_length);
+    tarchivist_store_u64(buffer + 32, (uint64_t)pos);
+    tarchivist_store_u64(buffer + 40, (uint64_t)pos + sizeof(tarchivist_raw_header_t) + header.size + TARCHIVIST_CLOSING_RECORD_SIZE);
+    tarchivist_store_u64(buffer + 48, hash);
+    tarchivist_store_u64(buffer + 56, (uint64_t)((last_pos >= 0) ? last_pos : pos)); /* Trailer itself if there are no members */
+
+    return tarchivist_write_buffered(tar, sizeof(buffer), buffer);
+}
+
+/* Moves the stream to where the new members should be written */
+static int tarchivist_seek_append_pos(tarchivist_t *tar) {
+    tarchivist_header_t header;
+    char buffer[TARCHIVIST_CLOSING_RECORD_SIZE];
+    int64_t size, end_offset;
+    int err;
+
+    /* Get file size */
+    err = tar->seek(tar, 0, TARCHIVIST_SEEK_END);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    size = tar->tell(tar);
+    if (size < 0) {
+        return (int)size;
+    }
+
+    /* Rewind back to the beginning of the file */
+    err = tar->seek(tar, 0, TARCHIVIST_SEEK_SET);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    if (size < TARCHIVIST_CLOSING_RECORD_SIZE) {
+        return TARCHIVIST_SUCCESS; /* File contains some non-tar garbage that will be overwritten */    
+    }
+
+    /* Check the first header */
+    err = tarchivist_read_header(tar, &header);
+    if (err == TARCHIVIST_BADCHKSUM || err == TARCHIVIST_NULLRECORD) {
+        return TARCHIVIST_SUCCESS; /* Again - some garbage or malformed tar */
+    }
+
+    /* Archive with the index trailer knows exactly where its data ends */
+    err = tarchivist_trailer_load(tar, size, tar->index, &end_offset);
+    if (err == TARCHIVIST_SUCCESS) {
+        return tar->seek(tar, end_offset, TARCHIVIST_SEEK_SET); /* Trailer will be overwritten */
+    }
+    if (err != TARCHIVIST_NOTFOUND) {
+        return err;
+    }
+
+    /* If the index is needed anyway, scanning the archive also gives the exact end of data */
+    if (tar->index != NULL) {
+        err = tarchivist_index_build(tar, tar->index);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+        return tar->seek(tar, tar->index->end_offset, TARCHIVIST_SEEK_SET);
+    }
+
+    /* This algorithm will fail if tar is not finalized and last 1024 bytes of last file content are zeros */
+    do
+    {
+        /* Seek to the beginning of the closing record */
+        err = tar->seek(tar, -TARCHIVIST_CLOSING_RECORD_SIZE, TARCHIVIST_SEEK_END);
+        if (err != TARCHIVIST_SUCCESS) {
+            break;
+        }
+
+        /* Read the content of the closing record */
+        err = tar->read(tar, TARCHIVIST_CLOSING_RECORD_SIZE, buffer);
+        if (err != TARCHIVIST_SUCCESS) {
+            break;
+        }
+
+        /* Check whether it is closing record indeed */
+        if (memcmp(buffer, tarchivist_zero_block, TARCHIVIST_CLOSING_RECORD_SIZE) == 0) {
+            /* Seek to the beginning of the closing record so that the next write will overwrite it */
+            err = tar->seek(tar, -TARCHIVIST_CLOSING_RECORD_SIZE, TARCHIVIST_SEEK_END);
+            break;
+        }
+        /* If it's not a closing record, do nothing */
+
+    } while (0);
+
+    return err;
+}
+
+int tarchivist_skip_closing_record(tarchivist_t *tar) {
+    int64_t pos;
+    int err;
+
+    err = tarchivist_seek_append_pos(tar);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    /* From now on the writer tracks the position on its own */
+    pos = tar->tell(tar);
+    if (pos < 0) {
+        return (int)pos;
+    }
+    tar->pos = pos;
+
+    return TARCHIVIST_SUCCESS;
+}
+
+static int tarchivist_index_create(tarchivist_t *tar) {
+    tar->index = tarchivist_alloc(tar->allocator, sizeof(tarchivist_index_t));
+    if (tar->index == NULL) {
+        return TARCHIVIST_NOMEMORY;
+    }
+    memset(tar->index, 0, sizeof(tarchivist_index_t));
+    tar->index->allocator = tar->allocator;
+    tar->owns_index = true;
+    return TARCHIVIST_SUCCESS;
+}
+
+static void tarchivist_index_release(tarchivist_t *tar) {
+    const tarchivist_allocator_t *allocator;
+
+    if (tar->owns_index) {
+        allocator = tar->index->allocator; /* Cleared by tarchivist_index_free */
+        tarchivist_index_free(tar->index);
+        tarchivist_release(allocator, tar->index, sizeof(tarchivist_index_t));
+        tar->index = NULL;
+        tar->owns_index = false;
+    }
+}
+
+static int tarchivist_index_open(tarchivist_t *tar) {
+    int64_t size, end_offset;
+    int err;
+
+    err = tarchivist_index_create(tar);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    /* Try to load the trailer, fall back to scanning the archive if it's missing or stale */
+    err = tar->seek(tar, 0, TARCHIVIST_SEEK_END);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    size = tar->tell(tar);
+    if (size < 0) {
+        return (int)size;
+    }
+
+    err = tarchivist_trailer_load(tar, size, tar->index, &end_offset);
+    if (err == TARCHIVIST_NOTFOUND) {
+        return tarchivist_index_build(tar, tar->index);
+    }
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    return tarchivist_rewind(tar);
+}
+
+int tarchivist_open(tarchivist_t *tar, const char *filename, const char *io_mode) {
+    tarchivist_header_t header;
+    bool use_index, use_uring;
+    int err;
+
+    if (tar == NULL || filename == NULL || io_mode == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    /* Clear tar struct */
+    memset(tar, 0, sizeof(tarchivist_t));
+
+    /* 'i' modifier enables the index, persisted in the archive as a trailer */
+    use_index = (strchr(io_mode, 'i') != NULL);
+
+    /* 'u' modifier asks for the io_uring backend, stdio is used if it's not available */
+    use_uring = (strchr(io_mode, 'u') != NULL);
+
+    /* Assign default IO functions */
+    tar->seek = tarchivist_seek_impl;
+    tar->tell = tarchivist_tell_impl;
+    tar->read = tarchivist_read_impl;
+    tar->write = tarchivist_write_impl;
+    tar->close = tarchivist_close_impl;
+#ifdef TARCHIVIST_POSIX
+    tar->pread = tarchivist_pread_impl;
+#endif
+    tar->sequential = (strchr(io_mode, 's') != NULL);
+
+    /* Ensure that file is opened and prepared properly */
+    switch (io_mode[0]) {
+        case 'r':
+            tar->finalize = false;
+            if (tar->sequential) {
+                /* 's' modifier reads the archive strictly forward, "-" stands for standard input */
+                if (use_index) {
+                    return TARCHIVIST_NOTSUPPORTED;
+                }
+                if (strcmp(filename, "-") == 0) {
+                    tar->stream = stdin;
+                    tar->close = tarchivist_close_std_impl;
+                }
+                else {
+                    tar->stream = fopen(filename, "rb");
+                    if (tar->stream == NULL) {
+                        return TARCHIVIST_OPENFAIL;
+                    }
+                }
+            }
+            else if (strchr(io_mode, 'm') != NULL) {
+                /* 'm' modifier maps the whole archive into memory */
+                err = tarchivist_map_open(tar, filename);
+                if (err != TARCHIVIST_SUCCESS) {
+                    return err;
+                }
+            }
+            else {
+                err = tarchivist_file_open(tar, filename, "rb", use_uring);
+                if (err != TARCHIVIST_SUCCESS) {
+                    return err;
+                }
+            }
+            /* Validate the file */
+            err = tarchivist_read_header(tar, &header);
+            if (err == TARCHIVIST_SUCCESS && use_index) {
+                err = tarchivist_index_open(tar);
+            }
+            if (err != TARCHIVIST_SUCCESS) {
+                tarchivist_index_release(tar);
+                tar->close(tar);
+                return err;
+            }
+            break;
+
+        case 'w':
+            tar->finalize = true;
+            if (tar->sequential) {
+                return TARCHIVIST_NOTSUPPORTED;
+            }
+            /* Writer needs no seeking, so "-" stands for standard output */
+            if (strcmp(filename, "-") == 0) {
+                tar->stream = stdout;
+                tar->close = tarchivist_close_std_impl;
+            }
+            else {
+                err = tarchivist_file_open(tar, filename, "wb", use_uring);
+                if (err != TARCHIVIST_SUCCESS) {
+                    return err;
+                }
+            }
+            if (use_index) {
+                err = tarchivist_index_create(tar);
+                if (err != TARCHIVIST_SUCCESS) {
+                    tar->close(tar);
+                    return err;
+                }
+            }
+            break;
+
+        case 'a':
+            tar->finalize = true;
+            if (tar->sequential) {
+                return TARCHIVIST_NOTSUPPORTED;
+            }
+            err = tarchivist_file_open(tar, filename, "rb+", use_uring); /* Little hack to be able to append to arbitrary places in file */
+            if (err == TARCHIVIST_OPENFAIL) {
+                err = tarchivist_file_open(tar, filename, "wb", use_uring);
+            }
+            if (err != TARCHIVIST_SUCCESS) {
+                return err;
+            }
+
+            err = use_index ? tarchivist_index_create(tar) : TARCHIVIST_SUCCESS;
+            if (err == TARCHIVIST_SUCCESS) {
+                err = tarchivist_skip_closing_record(tar);
+            }
+            if (err != TARCHIVIST_SUCCESS) {
+                tarchivist_index_release(tar);
+                tar->close(tar);
+                return err;
+            }
+            break;
+
+        default:
+            return TARCHIVIST_OPENFAIL;
+    }
+
+    return TARCHIVIST_SUCCESS;
+}
+
+int tarchivist_open_mem(tarchivist_t *tar, tarchivist_membuf_t *membuf, const char *io_mode) {
+    tarchivist_header_t header;
+    tarchivist_mem_t *mem;
+    bool use_index;
+    int err;
+
+    if (tar == NULL || membuf == NULL || io_mode == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    memset(tar, 0, sizeof(tarchivist_t));
+    use_index = (strchr(io_mode, 'i') != NULL);
+    if (strchr(io_mode, 's') != NULL) {
+        return TARCHIVIST_NOTSUPPORTED;
+    }
+
+    switch (io_mode[0]) {
+        case 'r':
+            if (membuf->data == NULL) {
+                return TARCHIVIST_OPENFAIL;
+            }
+            mem = malloc(sizeof(tarchivist_mem_t));
+            if (mem == NULL) {
+                return TARCHIVIST_NOMEMORY;
+            }
+            mem->data = membuf->data;
+            mem->size = membuf->size;
+            mem->pos = 0;
+
+            /* Buffer is treated just as a mapped archive, so headers and data are accessed in place */
+            tar->seek = tarchivist_mem_seek;
+            tar->tell = tarchivist_mem_tell;
+            tar->read = tarchivist_mem_read;
+            tar->write = tarchivist_mem_write_readonly;
+            tar->close = tarchivist_mem_close;
+            tar->pread = tarchivist_mem_pread;
+            tar->stream = mem;
+            tar->map = mem->data;
+            tar->map_size = mem->size;
+            tar->finalize = false;
+
+            /* Validate the archive */
+            err = tarchivist_read_header(tar, &header);
+            if (err == TARCHIVIST_SUCCESS && use_index) {
+                err = tarchivist_index_open(tar);
+            }
+            if (err != TARCHIVIST_SUCCESS) {
+                tarchivist_index_release(tar);
+                tar->close(tar);
+                return err;
+            }
+            break;
+
+        case 'w':
+            /* New archive, whatever the membuf held before is dropped, just as a file opened in 'w' mode gets truncated */
+            tarchivist_membuf_free(membuf);
+
+            /* Archive goes straight into the chunks, the write-back buffer would be just another copy */
+            tar->seek = tarchivist_membuf_seek;
+            tar->tell = tarchivist_membuf_tell;
+            tar->read = tarchivist_membuf_read_writeonly;
+            tar->write = tarchivist_membuf_write;
+            tar->close = tarchivist_membuf_close;
+            tar->stream = membuf;
+            tar->finalize = true;
+            tar->unbuffered = true;
+
+            if (use_index) {
+                err = tarchivist_index_create(tar);
+                if (err != TARCHIVIST_SUCCESS) {
+                    tar->close(tar);
+                    return err;
+                }
+            }
+            break;
+
+        default:
+            return TARCHIVIST_OPENFAIL;
+    }
+
+    return TARCHIVIST_SUCCESS;
+}
+
+int tarchivist_next(tarchivist_t *tar) {
+    tarchivist_header_t header;
+    int64_t next_pos;
+    int err;
+
+    if (tar == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    /* Read header */
+    err = tarchivist_read_header(tar, &header);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    tar->entry = NULL;
+
+    /* Forward-only stream skips the rest of the member by reading it */
+    next_pos = tar->last_data_pos + (int64_t)tarchivist_round_up(header.size, TARCHIVIST_TAR_BLOCK_SIZE);
+    if (tar->sequential) {
+        err = tarchivist_move(tar, tar->pos, next_pos);
+        tar->header_valid = false;
+        tar->bytes_left = 0;
+    }
+    else {
+        /* Data is followed by the next header, extended header is skipped along with the member */
+        err = tar->seek(tar, next_pos, TARCHIVIST_SEEK_SET);
+    }
+
+    if (err == TARCHIVIST_SUCCESS) {
+        tarchivist_cache_release(tar, next_pos, false); /* Whole member is behind */
+    }
+    return err;
+}
+
+int tarchivist_find(tarchivist_t *tar, const char *path, tarchivist_header_t *header) {
+    unsigned prefix_length, name_length, path_length;
+    char full_path[TARCHIVIST_PATH_MAX];
+    const tarchivist_entry_t *entry;
+    const char *name;
+    int err;
+
+    if (tar == NULL || path == NULL || header == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    /* With an index only a single seek to the member is needed */
+    if (tar->index != NULL) {
+        entry = tarchivist_index_lookup(tar->index, path);
+        if (entry == NULL) {
+            return TARCHIVIST_NOTFOUND;
+        }
+
+        tar->bytes_left = 0;
+        err = tar->seek(tar, entry->header_offset, TARCHIVIST_SEEK_SET);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+
+        err = tarchivist_read_header_at(tar, entry->header_offset, header);
+        tar->entry = (err == TARCHIVIST_SUCCESS) ? entry : NULL;
+        return err;
+    }
+
+    /* Search from the beginning of the archive, forward-only stream is searched from the current member on */
+    if (!tar->sequential) {
+        err = tarchivist_rewind(tar);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+    }
+
+    path_length = strlen(path);
+
+    /* Case where path is stored in the prefix field */
+    if (path_length > sizeof(header->name)) {
+        /* Extract file name */
+        name = strrchr(path, '/');
+
+        /* Pure filename longer than 100 chars, cannot be stored in USTAR archive */
+        if (name == NULL) {
+            return TARCHIVIST_NULLRECORD;
+        }
+
+        /* Compute lengths */
+        name++; /* Skip slash */
+        name_length = strlen(name);
+        prefix_length = path_length - name_length - 1;
+
+        /* This path cannot be stored in USTAR archive */
+        if (name_length > sizeof(header->name) || prefix_length > sizeof(header->prefix)) {
+            return TARCHIVIST_NULLRECORD;
+        }
+    }
+
+    /* Iterate until there's nothing left to read, matching the full path just as the index does */
+    while ((err = tarchivist_read_header(tar, header)) == TARCHIVIST_SUCCESS) {
+        if (tarchivist_full_path(full_path, header->prefix, header->name) == path_length && memcmp(path, full_path, path_length) == 0) {
+            break;
+        }
+
+        tarchivist_next(tar);
+    }
+
+    if (err == TARCHIVIST_NULLRECORD) {
+        return TARCHIVIST_NOTFOUND;
+    }
+    return err;
+}
+
+int tarchivist_read_header(tarchivist_t *tar, tarchivist_header_t *header) {
+    int64_t pos;
+
+    if (tar == NULL || header == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+    if (tar->sequential) {
+        return tarchivist_read_header_sequential(tar, header);
+    }
+
+    pos = tar->tell(tar);
+    if (pos < 0) {
+        return (int)pos;
+    }
+    return tarchivist_read_header_at(tar, pos, header);
+}
+
+long tarchivist_read_data(tarchivist_t *tar, unsigned size, void *data) {
+    tarchivist_header_t header;
+    int err;
+
+    if (tar == NULL || data == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+    if (tar->sequential) {
+        return tarchivist_read_data_sequential(tar, size, data);
+    }
+
+    /* If no bytes left to read then this is the first read, obtain the
+     * size from the header and go to the beginning of the data */
+    if (tar->bytes_left == 0) {
+        /* Member found in the index is already known, no need to read its header again */
+        if (tar->entry != NULL && tar->entry->header_offset == tar->last_header_pos) {
+            tar->bytes_left = tar->entry->size;
+            err = tar->seek(tar, tar->entry->data_offset, TARCHIVIST_SEEK_SET);
+        }
+        else {
+            err = tarchivist_read_header(tar, &header);
+            if (err != TARCHIVIST_SUCCESS) {
+                return err;
+            }
+            tar->bytes_left = header.size;
+
+            err = tar->seek(tar, tar->last_data_pos, TARCHIVIST_SEEK_SET);
+        }
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+    }
+
+    /* If requested to read more than left to read */
+    if (tar->bytes_left < size) {
+        size = (unsigned)tar->bytes_left;
+    }
+
+    /* Read data */
+    err = tar->read(tar, size, data);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    tar->bytes_left -= size;
+
+    /* If no data left, rewind back to the beginning of the record */
+    if (tar->bytes_left == 0) {
+        err = tar->seek(tar, tar->last_header_pos, TARCHIVIST_SEEK_SET);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+    }
+
+    /* If no errors, return real read size */
+    return size;
+}
+
+int tarchivist_view_data(tarchivist_t *tar, const void **data, uint64_t *size) {
+    tarchivist_header_t header;
+    int64_t data_pos;
+    int err;
+
+    if (tar == NULL || data == NULL || size == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+    if (tar->map == NULL) {
+        return TARCHIVIST_NOTSUPPORTED;
+    }
+
+    err = tarchivist_read_header(tar, &header);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    /* Member data is contiguous in the mapping, just point to it */
+    data_pos = tar->last_data_pos;
+    if ((uint64_t)data_pos > tar->map_size || tar->map_size - (size_t)data_pos < header.size) {
+        return TARCHIVIST_READFAIL;
+    }
+    *data = (const uint8_t *)tar->map + data_pos;
+    *size = header.size;
+
+    return TARCHIVIST_SUCCESS;
+}
+
+long tarchivist_pread(tarchivist_t *tar, const tarchivist_entry_t *member, uint64_t offset, unsigned size, void *data) {
+    int64_t pos;
+    int err, restore_err;
+
+    if (tar == NULL || member == NULL || data == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+    /* Written archive is in flux and the forward-only one can't go back */
+    if (tar->finalize || tar->sequential) {
+        return TARCHIVIST_NOTSUPPORTED;
+    }
+
+    /* Range is cut at the end of the member */
+    if (offset >= member->size) {
+        return 0;
+    }
+    if (member->size - offset < size) {
+        size = (unsigned)(member->size - offset);
+    }
+
+    if (tar->pread != NULL) {
+        err = tar->pread(tar, member->data_offset + (int64_t)offset, size, data);
+        return (err == TARCHIVIST_SUCCESS) ? (long)size : err;
+    }
+
+    /* Stream without positional reads is moved there and back */
+    pos = tar->tell(tar);
+    if (pos < 0) {
+        return (long)pos;
+    }
+    err = tar->seek(tar, member->data_offset + (int64_t)offset, TARCHIVIST_SEEK_SET);
+    if (err == TARCHIVIST_SUCCESS) {
+        err = tar->read(tar, size, data);
+    }
+    restore_err = tar->seek(tar, pos, TARCHIVIST_SEEK_SET);
+    if (err == TARCHIVIST_SUCCESS) {
+        err = restore_err;
+    }
+    return (err == TARCHIVIST_SUCCESS) ? (long)size : err;
+}
+
+/* Builds the extended header carrying the size that does not fit the octal field. Readers
+ * not aware of it still get the size from the base-256 encoded field of the real header */
+static void tarchivist_pax_header_init(tarchivist_raw_header_t *pax_header, char *record, const tarchivist_raw_header_t *raw_header, uint64_t size) {
+    unsigned name_length, length;
+
+    /* Record is "length size=value\n", length of at most 20 digits long value always has two digits */
+    memset(record, 0, TARCHIVIST_TAR_BLOCK_SIZE);
+    length = 2;
+    memcpy(record + length, " size=", 6);
+    length += 6;
+    length += tarchivist_format_decimal(record + length, size);
+    record[length++] = '\n';
+    record[0] = (char)('0' + length / 10);
+    record[1] = (char)('0' + length % 10);
+
+    /* Extended header inherits everything but name, size and type from the real one */
+    memcpy(pax_header, raw_header, sizeof(tarchivist_raw_header_t));
+    memset(pax_header->name, 0, sizeof(pax_header->name));
+    memcpy(pax_header->name, TARCHIVIST_PAX_PREFIX, sizeof(TARCHIVIST_PAX_PREFIX) - 1);
+    name_length = tarchivist_field_length(raw_header->name, sizeof(raw_header->name));
+    if (name_length > sizeof(pax_header->name) - (sizeof(TARCHIVIST_PAX_PREFIX) - 1)) {
+        name_length = sizeof(pax_header->name) - (sizeof(TARCHIVIST_PAX_PREFIX) - 1);
+    }
+    memcpy(pax_header->name + sizeof(TARCHIVIST_PAX_PREFIX) - 1, raw_header->name, name_length);
+    tarchivist_format_octal(pax_header->size, sizeof(pax_header->size), length);
+    pax_header->typeflag = TARCHIVIST_PAX;
+    memset(pax_header->linkname, 0, sizeof(pax_header->linkname));
+    tarchivist_store_checksum(pax_header, tarchivist_compute_checksum(pax_header));
+}
+
+static int tarchivist_write_pax_header(tarchivist_t *tar, const tarchivist_raw_header_t *raw_header, uint64_t size) {
+    tarchivist_raw_header_t pax_header;
+    char record[TARCHIVIST_TAR_BLOCK_SIZE];
+    int err;
+
+    tarchivist_pax_header_init(&pax_header, record, raw_header, size);
+
+    err = tarchivist_write_buffered(tar, sizeof(pax_header), &pax_header);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    return tarchivist_write_buffered(tar, sizeof(record), record);
+}
+
+/* Writes what precedes the header itself - the extended header if needed - and updates the index */
+static int tarchivist_begin_member(tarchivist_t *tar, const tarchivist_raw_header_t *raw_header, uint64_t size) {
+    const bool needs_pax = (size > TARCHIVIST_OCTAL_SIZE_MAX);
+    const int64_t pos = tar->pos;
+    int err;
+
+    if (needs_pax) {
+        err = tarchivist_write_pax_header(tar, raw_header, size);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+    }
+
+    /* Keep the index up to date with the written members */
+    if (tar->index != NULL) {
+        err = tarchivist_index_insert_member(tar->index, raw_header->prefix, raw_header->name, raw_header->typeflag, size, pos,
+                                             pos + (needs_pax ? 3 : 1) * (int64_t)sizeof(tarchivist_raw_header_t));
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+    }
+
+    return TARCHIVIST_SUCCESS;
+}
+
+static int tarchivist_write_raw_header(tarchivist_t *tar, const tarchivist_raw_header_t *raw_header, uint64_t size) {
+    int err;
+
+    err = tarchivist_begin_member(tar, raw_header, size);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    tar->bytes_left = size; /* Store size to know how many bytes of data has to be written */
+    return tarchivist_write_buffered(tar, sizeof(tarchivist_raw_header_t), raw_header);
+}
+
+/* Uses the writev callback if provided, otherwise writes the vectors one by one through the write-back buffer.
+ * At most TARCHIVIST_MEMBER_IOV_SIZE vectors are passed at once */
+static int tarchivist_write_vectors(tarchivist_t *tar, const tarchivist_iovec_t *iov, unsigned iovcnt) {
+    tarchivist_iovec_t vectors[TARCHIVIST_MEMBER_IOV_SIZE + 1];
+    size_t offset, chunk_size;
+    unsigned i, count = 0;
+    int err;
+
+    if (tar->writev != NULL) {
+        /* Buffered data goes first, so that it's flushed within the same call */
+        if (tar->buffer_used > 0) {
+            vectors[count].data = tar->buffer;
+            vectors[count].size = tar->buffer_used;
+            count++;
+        }
+        memcpy(&vectors[count], iov, iovcnt * sizeof(tarchivist_iovec_t));
+
+        err = tar->writev(tar, vectors, count + iovcnt);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+        tar->buffer_used = 0;
+        for (i = 0; i < iovcnt; ++i) {
+            tar->pos += (int64_t)iov[i].size;
+        }
+        tarchivist_cache_release(tar, tar->pos, false);
+        return TARCHIVIST_SUCCESS;
+    }
+
+    for (i = 0; i < iovcnt; ++i) {
+        for (offset = 0; offset < iov[i].size; offset += chunk_size) {
+            chunk_size = (iov[i].size - offset < TARCHIVIST_WRITE_CHUNK_SIZE) ? (iov[i].size - offset) : TARCHIVIST_WRITE_CHUNK_SIZE;
+            err = tarchivist_write_buffered(tar, (unsigned)chunk_size, (const uint8_t *)iov[i].data + offset);
+            if (err != TARCHIVIST_SUCCESS) {
+                return err;
+            }
+        }
+    }
+
+    return TARCHIVIST_SUCCESS;
+}
+
+int tarchivist_iter_init(tarchivist_t *tar, tarchivist_iter_t *iter) {
+    if (tar == NULL || iter == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    memset(iter, 0, sizeof(tarchivist_iter_t));
+    iter->tar = tar;
+
+    /* Forward-only stream is iterated from where it is, starting with the member whose header was already read */
+    if (tar->sequential) {
+        if (tar->pos < 0) {
+            return TARCHIVIST_SEEKFAIL;
+        }
+        iter->pos = tar->pos;
+        iter->next_pos = tar->header_valid ? tar->last_header_pos : tar->pos;
+        return TARCHIVIST_SUCCESS;
+    }
+    return tarchivist_rewind(tar);
+}
+
+int tarchivist_iter_next(tarchivist_iter_t *iter, tarchivist_header_t *header) {
+    tarchivist_t *tar;
+    int64_t data_pos;
+    uint64_t consumed = 0;
+    int err;
+
+    if (iter == NULL || header == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+    tar = iter->tar;
+
+    if (tar->sequential && tar->header_valid && iter->next_pos == tar->last_header_pos) {
+        /* Header of the forward-only stream was consumed before the iteration started, so was some data perhaps */
+        memcpy(header, &tar->header, sizeof(tarchivist_header_t));
+        tar->header_valid = false;
+        data_pos = tar->last_data_pos;
+        consumed = (uint64_t)(iter->pos - data_pos);
+    }
+    else {
+        /* Skip whatever is left of the previous member with a single forward seek */
+        if (iter->pos != iter->next_pos) {
+            err = tarchivist_move(tar, iter->pos, iter->next_pos);
+            if (err != TARCHIVIST_SUCCESS) {
+                return err;
+            }
+            iter->pos = iter->next_pos;
+        }
+        tarchivist_cache_release(tar, iter->pos, false);
+
+        err = tarchivist_read_member(tar, iter->pos, header, &data_pos);
+        if (err != TARCHIVIST_SUCCESS) {
+            iter->pos = -1; /* Position unknown after failed read */
+            tarchivist_track_pos(tar, -1);
+            return err;
+        }
+        if (tar->map == NULL) {
+            iter->pos = data_pos;
+            tarchivist_track_pos(tar, data_pos);
+        }
+    }
+
+    iter->header_pos = iter->next_pos;
+    iter->data_pos = data_pos;
+    iter->next_pos = data_pos + (int64_t)tarchivist_round_up(header->size, TARCHIVIST_TAR_BLOCK_SIZE);
+    iter->size = header->size;
+    iter->bytes_left = header->size - consumed;
+    tar->last_header_pos = iter->header_pos;
+    tar->last_data_pos = iter->data_pos;
+
+    return TARCHIVIST_SUCCESS;
+}
+
+long tarchivist_iter_read_data(tarchivist_iter_t *iter, unsigned size, void *data) {
+    tarchivist_t *tar;
+    unsigned read_size, pad_size = 0;
+    int64_t data_pos;
+    int err;
+
+    if (iter == NULL || data == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+    tar = iter->tar;
+
+    if (iter->bytes_left == 0) {
+        return 0;
+    }
+
+    /* Only needed if the stream has not been left at the data */
+    data_pos = iter->data_pos + (int64_t)(iter->size - iter->bytes_left);
+    if (iter->pos != data_pos) {
+        err = tarchivist_move(tar, iter->pos, data_pos);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+        iter->pos = data_pos;
+    }
+
+    /* If requested to read more than left to read */
+    if (iter->bytes_left < size) {
+        /* Take the padding along with the last chunk if it fits, so that no seek is needed to get to the next header */
+        pad_size = (unsigned)(tarchivist_round_up(iter->size, TARCHIVIST_TAR_BLOCK_SIZE) - iter->size);
+        if (size - iter->bytes_left < pad_size) {
+            pad_size = 0;
+        }
+        size = (unsigned)iter->bytes_left;
+    }
+
+    read_size = size + pad_size;
+    err = tar->read(tar, read_size, data);
+    if (err != TARCHIVIST_SUCCESS) {
+        iter->pos = -1;
+        tarchivist_track_pos(tar, -1);
+        return err;
+    }
+    iter->pos += read_size;
+    iter->bytes_left -= size;
+    tarchivist_track_pos(tar, iter->pos);
+
+    return size;
+}
+
+int tarchivist_write_header(tarchivist_t *tar, const tarchivist_header_t *header) {
+    tarchivist_raw_header_t raw_header;
+
+    if (tar == NULL || header == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    /* Prepare raw header */
+    tarchivist_header_to_raw(&raw_header, header);
+    return tarchivist_write_raw_header(tar, &raw_header, header->size);
+}
+
+int tarchivist_template_init(tarchivist_template_t *tpl, const tarchivist_header_t *header) {
+    tarchivist_raw_header_t *raw_header;
+
+    if (tpl == NULL || header == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+    raw_header = (tarchivist_raw_header_t *)tpl->raw;
+
+    /* Encode all the fields once, then clear the ones patched for each member */
+    tarchivist_header_to_raw(raw_header, header);
+    memset(raw_header->name, 0, sizeof(raw_header->name));
+    memset(raw_header->size, 0, sizeof(raw_header->size));
+    memset(raw_header->mtime, 0, sizeof(raw_header->mtime));
+    tpl->checksum = tarchivist_compute_checksum(raw_header);
+
+    return TARCHIVIST_SUCCESS;
+}
+
+int tarchivist_write_header_template(tarchivist_t *tar, const tarchivist_template_t *tpl, const char *name, uint64_t size, unsigned mtime) {
+    tarchivist_raw_header_t raw_header;
+    unsigned checksum;
+    unsigned length, i;
+
+    if (tar == NULL || tpl == NULL || name == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    memcpy(&raw_header, tpl->raw, sizeof(raw_header));
+    checksum = tpl->checksum;
+
+    /* Patch the fields, updating the checksum with the bytes written */
+    length = tarchivist_field_length(name, sizeof(raw_header.name));
+    memcpy(raw_header.name, name, length);
+    for (i = 0; i < length; ++i) {
+        checksum += (uint8_t)name[i];
+    }
+    checksum += tarchivist_format_size(raw_header.size, sizeof(raw_header.size), size);
+    checksum += tarchivist_format_octal(raw_header.mtime, sizeof(raw_header.mtime), mtime);
+    tarchivist_store_checksum(&raw_header, checksum);
+
+    return tarchivist_write_raw_header(tar, &raw_header, size);
+}
+
+/* Pads with zeros to multiple of a block size */
+static int tarchivist_write_padding(tarchivist_t *tar) {
+    const uint64_t pos = (uint64_t)tar->pos;
+    const unsigned pad_size = (unsigned)(tarchivist_round_up(pos, TARCHIVIST_TAR_BLOCK_SIZE) - pos);
+
+    /* If no padding required, job done */
+    if (pad_size == 0) {
+        return TARCHIVIST_SUCCESS;
+    }
+    return tarchivist_write_buffered(tar, pad_size, tarchivist_zero_block);
+}
+
+long tarchivist_write_data(tarchivist_t *tar, unsigned size, const void *data) {
+    int err;
+
+    if (tar == NULL || data == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    /* If requested to write more than left to write */
+    if (tar->bytes_left < size) {
+        size = (unsigned)tar->bytes_left;
+    }
+
+    /* Write data */
+    err = tarchivist_write_buffered(tar, size, data);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    tar->bytes_left -= size;
+
+    err = tarchivist_write_padding(tar);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    return size;
+}
+
+int tarchivist_write_member(tarchivist_t *tar, const tarchivist_header_t *header, const tarchivist_iovec_t *iov, unsigned iovcnt) {
+    tarchivist_raw_header_t raw_header;
+    tarchivist_header_t member;
+    tarchivist_iovec_t vectors[TARCHIVIST_MEMBER_IOV_SIZE];
+    uint64_t size = 0;
+    size_t padding;
+    unsigned i, count;
+    int err;
+
+    if (tar == NULL || header == NULL || (iov == NULL && iovcnt > 0)) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    /* Size of the member is the total size of the data vectors */
+    for (i = 0; i < iovcnt; ++i) {
+        size += iov[i].size;
+    }
+    memcpy(&member, header, sizeof(member));
+    member.size = size;
+    tarchivist_header_to_raw(&raw_header, &member);
+
+    err = tarchivist_begin_member(tar, &raw_header, size);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    /* Header, data and padding are gathered into as few writes as the vectors on the stack allow */
+    vectors[0].data = &raw_header;
+    vectors[0].size = sizeof(raw_header);
+    count = 1;
+    padding = (size_t)(tarchivist_round_up(size, TARCHIVIST_TAR_BLOCK_SIZE) - size);
+
+    tar->bytes_left = 0;
+    for (i = 0; i <= iovcnt; ++i) {
+        if (count == TARCHIVIST_MEMBER_IOV_SIZE) {
+            err = tarchivist_write_vectors(tar, vectors, count);
+            if (err != TARCHIVIST_SUCCESS) {
+                return err;
+            }
+            count = 0;
+        }
+        if (i < iovcnt) {
+            vectors[count++] = iov[i];
+        }
+        else if (padding > 0) {
+            vectors[count].data = tarchivist_zero_block;
+            vectors[count].size = padding;
+            count++;
+        }
+    }
+
+    return (count > 0) ? tarchivist_write_vectors(tar, vectors, count) : TARCHIVIST_SUCCESS;
+}
+
+int tarchivist_direct_begin(tarchivist_t *tar, int *fd, int64_t *offset, uint64_t *size) {
+    tarchivist_header_t header;
+    int64_t pos;
+    int err;
+
+    if (tar == NULL || fd == NULL || offset == NULL || size == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+    if (tar->sequential) {
+        return TARCHIVIST_NOTSUPPORTED; /* Transfers work on offsets, forward-only stream has none */
+    }
+
+    /* Buffered data has to precede whatever is written directly */
+    err = tarchivist_flush(tar);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    *fd = tarchivist_stream_fd(tar);
+    if (*fd < 0) {
+        return *fd;
+    }
+
+    /* When reading, the first transfer starts at the data of the current member, just as tarchivist_read_data */
+    if (!tar->finalize && tar->bytes_left == 0) {
+        err = tarchivist_read_header(tar, &header);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+        tar->bytes_left = header.size;
+        pos = tar->last_data_pos;
+    }
+    else if (tar->finalize) {
+        pos = tar->pos;
+    }
+    else {
+        pos = tar->tell(tar);
+        if (pos < 0) {
+            return (int)pos;
+        }
+    }
+
+    tar->direct_pos = pos;
+    *offset = pos;
+    *size = tar->bytes_left;
+    return TARCHIVIST_SUCCESS;
+}
+
+int tarchivist_direct_end(tarchivist_t *tar, uint64_t size) {
+    int err;
+
+    if (tar == NULL || size > tar->bytes_left) {
+        return TARCHIVIST_FAILURE;
+    }
+    tar->bytes_left -= size;
+
+    /* Descriptor has been used directly, so the stream has to be moved past the transferred data */
+    if (!tar->finalize && tar->bytes_left == 0) {
+        return tar->seek(tar, tar->last_header_pos, TARCHIVIST_SEEK_SET); /* Back to the beginning of the record */
+    }
+    err = tar->seek(tar, tar->direct_pos + (int64_t)size, TARCHIVIST_SEEK_SET);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    if (tar->finalize) {
+        tar->pos = tar->direct_pos + (int64_t)size;
+        tarchivist_cache_release(tar, tar->pos, false);
+    }
+
+    if (tar->finalize && tar->bytes_left == 0) {
+        return tarchivist_write_padding(tar);
+    }
+    return TARCHIVIST_SUCCESS;
+}
+
+int tarchivist_flush(tarchivist_t *tar) {
+    int err;
+
+    if (tar == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+    if (tar->buffer_used == 0) {
+        return TARCHIVIST_SUCCESS;
+    }
+
+    err = tar->write(tar, tar->buffer_used, tar->buffer);
+    tar->buffer_used = 0;
+    return err;
+}
+
+int tarchivist_set_buffer(tarchivist_t *tar, unsigned size) {
+    int err;
+
+    if (tar == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    err = tarchivist_flush(tar);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    tarchivist_release(tar->allocator, tar->buffer, tar->buffer_size);
+    tar->buffer = NULL;
+
+    /* New buffer gets allocated on the first write */
+    tar->unbuffered = (size == 0);
+    tar->buffer_size = (unsigned)tarchivist_round_up(size, TARCHIVIST_TAR_BLOCK_SIZE);
+    return TARCHIVIST_SUCCESS;
+}
+
+int tarchivist_set_allocator(tarchivist_t *tar, const tarchivist_allocator_t *allocator) {
+    int err;
+
+    if (tar == NULL || (allocator != NULL && (allocator->alloc == NULL || allocator->resize == NULL || allocator->release == NULL))) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    /* Buffer goes back to where it came from, the new one gets allocated on the first write */
+    err = tarchivist_flush(tar);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    tarchivist_release(tar->allocator, tar->buffer, tar->buffer_size);
+    tar->buffer = NULL;
+
+    tar->allocator = allocator;
+    return TARCHIVIST_SUCCESS;
+}
+
+int tarchivist_set_cache_policy(tarchivist_t *tar, int policy) {
+#if defined(TARCHIVIST_POSIX) && defined(POSIX_FADV_DONTNEED)
+    int64_t pos;
+    int fd;
+#endif
+
+    if (tar == NULL || (policy != TARCHIVIST_CACHE_KEEP && policy != TARCHIVIST_CACHE_DROP)) {
+        return TARCHIVIST_FAILURE;
+    }
+    if (policy == TARCHIVIST_CACHE_KEEP) {
+        tar->cache_policy = policy;
+        return TARCHIVIST_SUCCESS;
+    }
+
+#if defined(TARCHIVIST_POSIX) && defined(POSIX_FADV_DONTNEED)
+    /* Page cache is managed through the descriptor */
+    fd = tarchivist_stream_fd(tar);
+    if (fd < 0) {
+        return fd;
+    }
+    pos = (tar->finalize || tar->sequential) ? (tar->pos - tar->buffer_used) : tar->tell(tar);
+    if (pos < 0) {
+        return (int)pos;
+    }
+
+    /* Archive is streamed once, so larger read-ahead pays off; fails for pipes, which have no page cache to manage */
+    if (posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL) != 0) {
+        return TARCHIVIST_NOTSUPPORTED;
+    }
+
+    tar->cache_policy = policy;
+    tar->cache_fd = fd;
+    tar->cache_dropped = pos;
+    tar->cache_flushed = pos;
+    return TARCHIVIST_SUCCESS;
+#else
+    return TARCHIVIST_NOTSUPPORTED;
+#endif
+}
+
+#ifdef TARCHIVIST_POSIX
+/* Reads the member at pos into the slot, false means there's nothing to prefetch there */
+static bool tarchivist_readahead_fetch(const tarchivist_readahead_t *readahead, tarchivist_prefetch_t *prefetch, int64_t pos, int64_t *next_pos) {
+    tarchivist_header_t header;
+    uint64_t pax_size = 0, size = 0, data_length;
+    bool has_size = false;
+    unsigned meta_length;
+
+    if (!tarchivist_pread_fd(readahead->fd, prefetch->data, TARCHIVIST_TAR_BLOCK_SIZE, pos) ||
+        tarchivist_raw_to_header(&header, (const tarchivist_raw_header_t *)prefetch->data) != TARCHIVIST_SUCCESS) {
+        return false;
+    }
+
+    /* Extended header is prefetched along with the member it applies to */
+    if (header.typeflag == TARCHIVIST_PAX) {
+        pax_size = tarchivist_round_up(header.size, TARCHIVIST_TAR_BLOCK_SIZE);
+        if (pax_size + 2 * TARCHIVIST_TAR_BLOCK_SIZE > TARCHIVIST_READAHEAD_META_SIZE) {
+            return false;
+        }
+        if (!tarchivist_pread_fd(readahead->fd, prefetch->data + TARCHIVIST_TAR_BLOCK_SIZE, (size_t)pax_size + TARCHIVIST_TAR_BLOCK_SIZE, pos + TARCHIVIST_TAR_BLOCK_SIZE) ||
+            tarchivist_pax_parse((const char *)prefetch->data + TARCHIVIST_TAR_BLOCK_SIZE, header.size, &size, &has_size) != TARCHIVIST_SUCCESS ||
+            tarchivist_raw_to_header(&header, (const tarchivist_raw_header_t *)(prefetch->data + TARCHIVIST_TAR_BLOCK_SIZE + pax_size)) != TARCHIVIST_SUCCESS) {
+            return false;
+        }
+        if (has_size) {
+            header.size = size;
+        }
+        pax_size += TARCHIVIST_TAR_BLOCK_SIZE;
+    }
+
+    meta_length = TARCHIVIST_TAR_BLOCK_SIZE + (unsigned)pax_size;
+    data_length = tarchivist_round_up(header.size, TARCHIVIST_TAR_BLOCK_SIZE);
+    *next_pos = pos + meta_length + (int64_t)data_length;
+    if (data_length > readahead->data_size) {
+        data_length = readahead->data_size;
+    }
+
+    prefetch->next = NULL;
+    prefetch->offset = pos;
+    prefetch->length = meta_length + (unsigned)data_length;
+    if (!tarchivist_pread_fd(readahead->fd, prefetch->data + meta_length, (size_t)data_length, pos + meta_length)) {
+        prefetch->length = meta_length; /* Truncated archive, the error will be reported to the consumer by the stream */
+    }
+    return true;
+}
+
+static void *tarchivist_readahead_thread(void *arg) {
+    tarchivist_readahead_t *readahead = arg;
+    tarchivist_prefetch_t *prefetch;
+    int64_t pos, next_pos = 0;
+    unsigned generation;
+    bool fetched;
+
+    pthread_mutex_lock(&readahead->lock);
+    while (!readahead->stop) {
+        if (readahead->at_end || readahead->free == NULL ||
+            readahead->used + TARCHIVIST_TAR_BLOCK_SIZE + readahead->data_size > readahead->budget) {
+            pthread_cond_wait(&readahead->cond, &readahead->lock);
+            continue;
+        }
+        prefetch = readahead->free;
+        readahead->free = prefetch->next;
+        pos = readahead->scan_pos;
+        generation = readahead->generation;
+        pthread_mutex_unlock(&readahead->lock);
+
+        fetched = tarchivist_readahead_fetch(readahead, prefetch, pos, &next_pos);
+
+        pthread_mutex_lock(&readahead->lock);
+        /* Consumer went elsewhere in the meantime, or there was nothing to prefetch */
+        if (generation != readahead->generation || !fetched) {
+            prefetch->next = readahead->free;
+            readahead->free = prefetch;
+            readahead->at_end = (generation == readahead->generation);
+            continue;
+        }
+
+        if (readahead->tail != NULL) {
+            readahead->tail->next = prefetch;
+        }
+        else {
+            readahead->head = prefetch;
+        }
+        readahead->tail = prefetch;
+        readahead->used += prefetch->length;
+        readahead->scan_pos = next_pos;
+        readahead->stats.prefetched++;
+    }
+    pthread_mutex_unlock(&readahead->lock);
+
+    return NULL;
+}
+
+/* Gives back the slots of the prefetched members preceding the given one, all of them if NULL */
+static void tarchivist_readahead_drop(tarchivist_readahead_t *readahead, const tarchivist_prefetch_t *until) {
+    tarchivist_prefetch_t *prefetch;
+
+    while (readahead->head != NULL && readahead->head != until) {
+        prefetch = readahead->head;
+        readahead->head = prefetch->next;
+        readahead->used -= prefetch->length;
+        prefetch->next = readahead->free;
+        readahead->free = prefetch;
+    }
+    if (readahead->head == NULL) {
+        readahead->tail = NULL;
+    }
+    pthread_cond_signal(&readahead->cond);
+}
+
+static int tarchivist_readahead_read(tarchivist_t *tar, unsigned size, void *data) {
+    tarchivist_readahead_t *readahead = tar->readahead;
+    tarchivist_prefetch_t *prefetch;
+    unsigned chunk_size = 0;
+    int err;
+
+    pthread_mutex_lock(&readahead->lock);
+    for (prefetch = readahead->head; prefetch != NULL; prefetch = prefetch->next) {
+        if (prefetch->offset <= readahead->pos && readahead->pos < prefetch->offset + prefetch->length) {
+            break;
+        }
+    }
+
+    if (prefetch != NULL) {
+        chunk_size = (unsigned)(prefetch->offset + prefetch->length - readahead->pos);
+        if (chunk_size > size) {
+            chunk_size = size;
+        }
+        memcpy(data, prefetch->data + (readahead->pos - prefetch->offset), chunk_size);
+        tarchivist_readahead_drop(readahead, prefetch); /* Members before this one are done with */
+    }
+    else if (readahead->pos < ((readahead->head != NULL) ? readahead->head->offset : readahead->scan_pos) || readahead->pos > readahead->scan_pos) {
+        /* Consumer moved outside of the prefetched part of the archive, start over from there */
+        tarchivist_readahead_drop(readahead, NULL);
+        readahead->scan_pos = readahead->pos;
+        readahead->at_end = false;
+        readahead->generation++;
+    }
+
+    if (chunk_size == size) {
+        readahead->stats.hits++;
+    }
+    else {
+        readahead->stats.misses++;
+    }
+    readahead->stats.hit_bytes += chunk_size;
+    readahead->stats.miss_bytes += size - chunk_size;
+    pthread_mutex_unlock(&readahead->lock);
+
+    readahead->pos += chunk_size;
+    if (chunk_size == size) {
+        readahead->stream_behind = true;
+        return TARCHIVIST_SUCCESS;
+    }
+
+    /* Rest of the data comes from the stream */
+    if (readahead->stream_behind || chunk_size > 0) {
+        err = readahead->seek(tar, readahead->pos, TARCHIVIST_SEEK_SET);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+        readahead->stream_behind = false;
+    }
+    err = readahead->read(tar, size - chunk_size, (uint8_t *)data + chunk_size);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    readahead->pos += size - chunk_size;
+    return TARCHIVIST_SUCCESS;
+}
+
+static int tarchivist_readahead_seek(tarchivist_t *tar, int64_t offset, int whence) {
+    tarchivist_readahead_t *readahead = tar->readahead;
+    int64_t pos;
+    int err;
+
+    err = readahead->seek(tar, offset, whence);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    pos = (whence == TARCHIVIST_SEEK_SET) ? offset : readahead->tell(tar);
+    if (pos < 0) {
+        return (int)pos;
+    }
+    readahead->pos = pos;
+    readahead->stream_behind = false;
+    return TARCHIVIST_SUCCESS;
+}
+
+static int64_t tarchivist_readahead_tell(tarchivist_t *tar) {
+    const tarchivist_readahead_t *readahead = tar->readahead;
+    return readahead->pos;
+}
+#endif
+
+int tarchivist_readahead_start(tarchivist_t *tar, unsigned depth, size_t budget) {
+#ifdef TARCHIVIST_POSIX
+    tarchivist_readahead_t *readahead;
+    size_t slot_size;
+    int64_t pos;
+    unsigned i;
+    int fd;
+
+    if (tar == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+    if (tar->readahead != NULL) {
+        return TARCHIVIST_SUCCESS;
+    }
+    /* Prefetching needs random access to the archive file, through its descriptor; mapped archive needs none */
+    if (tar->finalize || tar->sequential || tar->map != NULL) {
+        return TARCHIVIST_NOTSUPPORTED;
+    }
+    fd = tarchivist_stream_fd(tar);
+    if (fd < 0) {
+        return fd;
+    }
+    pos = tar->tell(tar);
+    if (pos < 0) {
+        return (int)pos;
+    }
+
+    readahead = calloc(1, sizeof(tarchivist_readahead_t));
+    if (readahead == NULL) {
+        return TARCHIVIST_NOMEMORY;
+    }
+    readahead->depth = (depth > 0) ? depth : TARCHIVIST_READAHEAD_DEPTH;
+    readahead->budget = (budget > 0) ? budget : TARCHIVIST_READAHEAD_BUDGET;
+    if (readahead->budget < TARCHIVIST_TAR_BLOCK_SIZE) {
+        readahead->budget = TARCHIVIST_TAR_BLOCK_SIZE;
+    }
+    /* Data prefetched per member is limited so that the whole depth fits the budget */
+    readahead->data_size = (unsigned)((readahead->budget / readahead->depth) / TARCHIVIST_TAR_BLOCK_SIZE * TARCHIVIST_TAR_BLOCK_SIZE);
+    readahead->data_size = (readahead->data_size > TARCHIVIST_TAR_BLOCK_SIZE) ? readahead->data_size - TARCHIVIST_TAR_BLOCK_SIZE : 0;
+    if (readahead->data_size > TARCHIVIST_READAHEAD_DATA_SIZE) {
+        readahead->data_size = TARCHIVIST_READAHEAD_DATA_SIZE;
+    }
+
+    /* Slots are reused for the whole lifetime of the engine, so prefetching itself never allocates */
+    slot_size = TARCHIVIST_READAHEAD_META_SIZE + readahead->data_size;
+    readahead->slots = malloc(readahead->depth * (sizeof(tarchivist_prefetch_t) + slot_size));
+    if (readahead->slots == NULL) {
+        free(readahead);
+        return TARCHIVIST_NOMEMORY;
+    }
+    for (i = 0; i < readahead->depth; ++i) {
+        readahead->slots[i].data = (uint8_t *)(readahead->slots + readahead->depth) + i * slot_size;
+        readahead->slots[i].next = readahead->free;
+        readahead->free = &readahead->slots[i];
+    }
+
+    readahead->fd = fd;
+    readahead->pos = pos;
+    readahead->scan_pos = pos;
+    readahead->seek = tar->seek;
+    readahead->tell = tar->tell;
+    readahead->read = tar->read;
+
+    if (pthread_mutex_init(&readahead->lock, NULL) != 0) {
+        free(readahead->slots);
+        free(readahead);
+        return TARCHIVIST_FAILURE;
+    }
+    if (pthread_cond_init(&readahead->cond, NULL) != 0) {
+        pthread_mutex_destroy(&readahead->lock);
+        free(readahead->slots);
+        free(readahead);
+        return TARCHIVIST_FAILURE;
+    }
+    if (pthread_create(&readahead->thread, NULL, tarchivist_readahead_thread, readahead) != 0) {
+        pthread_cond_destroy(&readahead->cond);
+        pthread_mutex_destroy(&readahead->lock);
+        free(readahead->slots);
+        free(readahead);
+        return TARCHIVIST_FAILURE;
+    }
+
+    tar->readahead = readahead;
+    tar->seek = tarchivist_readahead_seek;
+    tar->tell = tarchivist_readahead_tell;
+    tar->read = tarchivist_readahead_read;
+    return TARCHIVIST_SUCCESS;
+#else
+    (void)depth;
+    (void)budget;
+    return (tar == NULL) ? TARCHIVIST_FAILURE : TARCHIVIST_NOTSUPPORTED;
+#endif
+}
+
+int tarchivist_readahead_stats(const tarchivist_t *tar, tarchivist_readahead_stats_t *stats) {
+    if (tar == NULL || stats == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+    if (tar->readahead == NULL) {
+        return TARCHIVIST_NOTSUPPORTED;
+    }
+#ifdef TARCHIVIST_POSIX
+    pthread_mutex_lock(&tar->readahead->lock);
+    memcpy(stats, &tar->readahead->stats, sizeof(tarchivist_readahead_stats_t));
+    pthread_mutex_unlock(&tar->readahead->lock);
+#endif
+    return TARCHIVIST_SUCCESS;
+}
+
+int tarchivist_readahead_stop(tarchivist_t *tar) {
+#ifdef TARCHIVIST_POSIX
+    tarchivist_readahead_t *readahead;
+    bool stream_behind;
+    int64_t pos;
+
+    if (tar == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+    readahead = tar->readahead;
+    if (readahead == NULL) {
+        return TARCHIVIST_SUCCESS;
+    }
+
+    pthread_mutex_lock(&readahead->lock);
+    readahead->stop = true;
+    pthread_cond_signal(&readahead->cond);
+    pthread_mutex_unlock(&readahead->lock);
+    pthread_join(readahead->thread, NULL);
+
+    tarchivist_readahead_drop(readahead, NULL);
+    pthread_cond_destroy(&readahead->cond);
+    pthread_mutex_destroy(&readahead->lock);
+
+    tar->seek = readahead->seek;
+    tar->tell = readahead->tell;
+    tar->read = readahead->read;
+    stream_behind = readahead->stream_behind;
+    pos = readahead->pos;
+    tar->readahead = NULL;
+    free(readahead->slots);
+    free(readahead);
+
+    /* Stream continues where the consumer is */
+    return stream_behind ? tar->seek(tar, pos, TARCHIVIST_SEEK_SET) : TARCHIVIST_SUCCESS;
+#else
+    return (tar == NULL) ? TARCHIVIST_FAILURE : TARCHIVIST_SUCCESS;
+#endif
+}
+
+int tarchivist_close(tarchivist_t *tar) {
+    int err = TARCHIVIST_SUCCESS;
+
+    if (tar == NULL || tar->stream == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    tarchivist_readahead_stop(tar);
+
+    /* Finalize the archive if required */
+    if (tar->finalize) {
+        /* Store the index as a trailer, so that it doesn't have to be rebuilt on open */
+        if (tar->index != NULL) {
+            err = tarchivist_trailer_write(tar);
+        }
+
+        if (err == TARCHIVIST_SUCCESS) {
+            err = tarchivist_write_buffered(tar, TARCHIVIST_CLOSING_RECORD_SIZE, tarchivist_zero_block);
+        }
+
+        if (err == TARCHIVIST_SUCCESS) {
+            err = tarchivist_flush(tar);
+        }
+        if (err == TARCHIVIST_SUCCESS) {
+            tarchivist_cache_release(tar, tar->pos, true);
+        }
+    }
+    else if (tar->cache_policy == TARCHIVIST_CACHE_DROP) {
+        tarchivist_cache_release(tar, tar->sequential ? tar->pos : tar->tell(tar), true);
+    }
+
+    tarchivist_release(tar->allocator, tar->buffer, tar->buffer_size);
+    tar->buffer = NULL;
+    tar->buffer_used = 0;
+    tarchivist_index_release(tar);
+
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    return tar->close(tar);
+}
+
+int tarchivist_index_build(tarchivist_t *tar, tarchivist_index_t *index) {
+    tarchivist_iter_t iter;
+    tarchivist_header_t header;
+    int err;
+
+    if (tar == NULL || index == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    memset(index, 0, sizeof(tarchivist_index_t));
+    index->allocator = tar->allocator;
+
+    err = tarchivist_iter_init(tar, &iter);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    /* Single sequential pass, every header is read exactly once */
+    while ((err = tarchivist_iter_next(&iter, &header)) == TARCHIVIST_SUCCESS) {
+        err = tarchivist_index_insert_member(index, header.prefix, header.name, header.typeflag, header.size, iter.header_pos, iter.data_pos);
+        if (err != TARCHIVIST_SUCCESS) {
+            break;
+        }
+    }
+
+    /* Null record marks the end of the archive, a non-finalized one just ends */
+    if (err == TARCHIVIST_NULLRECORD || err == TARCHIVIST_READFAIL) {
+        index->end_offset = iter.next_pos;
+        err = tarchivist_rewind(tar);
+    }
+
+    if (err != TARCHIVIST_SUCCESS) {
+        tarchivist_index_free(index);
+        return err;
+    }
+
+    /* Index managed by the library (the 'i' modifier) gives way to the caller's one */
+    if (tar->index != index) {
+        tarchivist_index_release(tar);
+        tar->index = index;
+    }
+    return TARCHIVIST_SUCCESS;
+}
+
+const tarchivist_entry_t *tarchivist_index_lookup(const tarchivist_index_t *index, const char *path) {
+    unsigned bucket;
+
+    if (index == NULL || path == NULL || index->bucket_count == 0) {
+        return NULL;
+    }
+
+    bucket = *tarchivist_index_bucket(index, path, strlen(path));
+    return (bucket != 0) ? &index->entries[bucket - 1] : NULL;
+}
+
+void tarchivist_index_free(tarchivist_index_t *index) {
+    tarchivist_pool_block_t *block;
+
+    if (index == NULL) {
+        return;
+    }
+
+    while (index->pool != NULL) {
+        block = index->pool;
+        index->pool = block->next;
+        tarchivist_release(index->allocator, block, sizeof(tarchivist_pool_block_t));
+    }
+    tarchivist_release(index->allocator, index->buckets, index->bucket_count * sizeof(unsigned));
+    tarchivist_release(index->allocator, index->entries, index->capacity * sizeof(tarchivist_entry_t));
+    memset(index, 0, sizeof(tarchivist_index_t));
+}
+
+static void *tarchivist_arena_alloc(void *ctx, size_t size) {
+    tarchivist_arena_t *arena = ctx;
+    const uintptr_t start = (uintptr_t)(arena->memory + arena->used);
+    const size_t offset = arena->used + (size_t)(tarchivist_round_up(start, TARCHIVIST_ARENA_ALIGNMENT) - start);
+
+    if (offset > arena->size || arena->size - offset < size) {
+        return NULL;
+    }
+    arena->last = offset;
+    arena->used = offset + size;
+    return arena->memory + offset;
+}
+
+static void *tarchivist_arena_resize(void *ctx, void *ptr, size_t old_size, size_t size) {
+    tarchivist_arena_t *arena = ctx;
+    uint8_t *resized;
+
+    /* Most recent allocation just grows or shrinks in place */
+    if (ptr != NULL && (uint8_t *)ptr == arena->memory + arena->last) {
+        if (arena->size - arena->last < size) {
+            return NULL;
+        }
+        arena->used = arena->last + size;
+        return ptr;
+    }
+
+    resized = tarchivist_arena_alloc(ctx, size);
+    if (resized != NULL && ptr != NULL) {
+        memcpy(resized, ptr, (old_size < size) ? old_size : size);
+    }
+    return resized;
+}
+
+/* Only the most recent allocation is given back, the rest waits for the reset */
+static void tarchivist_arena_release(void *ctx, void *ptr, size_t size) {
+    tarchivist_arena_t *arena = ctx;
+
+    (void)size;
+    if ((uint8_t *)ptr == arena->memory + arena->last) {
+        arena->used = arena->last;
+    }
+}
+
+int tarchivist_arena_init(tarchivist_arena_t *arena, void *memory, size_t size) {
+    if (arena == NULL || (memory == NULL && size > 0)) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    arena->allocator.alloc = tarchivist_arena_alloc;
+    arena->allocator.resize = tarchivist_arena_resize;
+    arena->allocator.release = tarchivist_arena_release;
+    arena->allocator.ctx = arena;
+    arena->memory = memory;
+    arena->size = size;
+    arena->used = 0;
+    arena->last = 0;
+    return TARCHIVIST_SUCCESS;
+}
+
+void tarchivist_arena_reset(tarchivist_arena_t *arena) {
+    if (arena == NULL) {
+        return;
+    }
+
+    arena->used = 0;
+    arena->last = 0;
+}
+
+int tarchivist_membuf_init(tarchivist_membuf_t *membuf, const void *data, size_t size) {
+    if (membuf == NULL || (data == NULL && size > 0)) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    memset(membuf, 0, sizeof(tarchivist_membuf_t));
+    membuf->data = data;
+    membuf->size = size;
+    membuf->chunk_size = TARCHIVIST_MEM_CHUNK_SIZE;
+    return TARCHIVIST_SUCCESS;
+}
+
+tarchivist_mem_chunk_t *tarchivist_membuf_release(tarchivist_membuf_t *membuf) {
+    tarchivist_mem_chunk_t *head;
+
+    if (membuf == NULL) {
+        return NULL;
+    }
+
+    /* Every chunk is a single allocation, to be freed by the caller */
+    head = membuf->head;
+    membuf->head = NULL;
+    membuf->tail = NULL;
+    membuf->size = 0;
+    return head;
+}
+
+void tarchivist_membuf_free(tarchivist_membuf_t *membuf) {
+    tarchivist_mem_chunk_t *chunk;
+
+    if (membuf == NULL) {
+        return;
+    }
+
+    while (membuf->head != NULL) {
+        chunk = membuf->head;
+        membuf->head = chunk->next;
+        free(chunk);
+    }
+    membuf->tail = NULL;
+    membuf->size = 0;
+}
+
+int tarchivist_shared_open(tarchivist_shared_t *shared, const char *filename, const char *io_mode) {
+    int err;
+
+    if (shared == NULL || io_mode == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+    memset(shared, 0, sizeof(tarchivist_shared_t));
+
+    /* Readers need random access and nothing may change under them */
+    if (io_mode[0] != 'r' || strchr(io_mode, 's') != NULL) {
+        return TARCHIVIST_NOTSUPPORTED;
+    }
+
+    err = tarchivist_open(&shared->tar, filename, io_mode);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    /* With the 'i' modifier the index is already there */
+    if (shared->tar.index == NULL) {
+        err = tarchivist_index_build(&shared->tar, &shared->index);
+        if (err != TARCHIVIST_SUCCESS) {
+            tarchivist_close(&shared->tar);
+            return err;
+        }
+    }
+
+    return TARCHIVIST_SUCCESS;
+}
+
+int tarchivist_shared_close(tarchivist_shared_t *shared) {
+    int err;
+
+    if (shared == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    err = tarchivist_close(&shared->tar);
+    tarchivist_index_free(&shared->index);
+    return err;
+}
+
+int tarchivist_reader_open(tarchivist_reader_t *reader, tarchivist_shared_t *shared, const char *path) {
+    const tarchivist_entry_t *entry;
+
+    if (reader == NULL || shared == NULL || path == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    /* Index is not modified once built, so lookups need no locking */
+    entry = tarchivist_index_lookup(shared->tar.index, path);
+    if (entry == NULL) {
+        return TARCHIVIST_NOTFOUND;
+    }
+
+    reader->shared = shared;
+    reader->entry = entry;
+    reader->offset = 0;
+    return TARCHIVIST_SUCCESS;
+}
+
+long tarchivist_reader_read(tarchivist_reader_t *reader, unsigned size, void *data) {
+    long ret;
+
+    if (reader == NULL || reader->entry == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    /* Positional read leaves the shared stream alone, the cursor is only the reader's own */
+    ret = tarchivist_pread(&reader->shared->tar, reader->entry, reader->offset, size, data);
+    if (ret > 0) {
+        reader->offset += (uint64_t)ret;
+    }
+    return ret;
+}
+
+int tarchivist_reader_view(tarchivist_reader_t *reader, const void **data, uint64_t *size) {
+    const tarchivist_t *tar;
+
+    if (reader == NULL || reader->entry == NULL || data == NULL || size == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+    tar = &reader->shared->tar;
+    if (tar->map == NULL) {
+        return TARCHIVIST_NOTSUPPORTED;
+    }
+
+    if ((uint64_t)reader->entry->data_offset > tar->map_size || tar->map_size - (size_t)reader->entry->data_offset < reader->entry->size) {
+        return TARCHIVIST_READFAIL;
+    }
+    *data = (const uint8_t *)tar->map + reader->entry->data_offset;
+    *size = reader->entry->size;
+    return TARCHIVIST_SUCCESS;
+}
+
+/* Ends a single pass over the archive which stopped on reading the header at pos. Null record marks the end
+ * of the archive, a non-finalized one just ends; then the stream goes back to the beginning, if it can */
+static int tarchivist_pass_end(tarchivist_t *tar, int err, int64_t pos) {
+    if (err != TARCHIVIST_NULLRECORD && err != TARCHIVIST_READFAIL) {
+        return err;
+    }
+    if (tar->sequential) {
+        tar->pos = (err == TARCHIVIST_NULLRECORD) ? (pos + TARCHIVIST_TAR_BLOCK_SIZE) : -1;
+        return TARCHIVIST_SUCCESS;
+    }
+    return tarchivist_rewind(tar);
+}
+
+static int tarchivist_list_grow(tarchivist_list_t *list) {
+    const unsigned capacity = (list->capacity > 0) ? (2 * list->capacity) : TARCHIVIST_LIST_MIN_CAPACITY;
+    tarchivist_list_t grown;
+    uint8_t *block;
+
+    /* All the arrays share a single allocation, the 64-bit ones first to keep them aligned */
+    block = tarchivist_alloc(list->allocator, capacity * TARCHIVIST_LIST_MEMBER_SIZE);
+    if (block == NULL) {
+        return TARCHIVIST_NOMEMORY;
+    }
+    grown.header_offsets = (int64_t *)block;
+    grown.data_offsets = grown.header_offsets + capacity;
+    grown.sizes = (uint64_t *)(grown.data_offsets + capacity);
+    grown.path_offsets = (size_t *)(grown.sizes + capacity);
+    grown.mtimes = (unsigned *)(grown.path_offsets + capacity);
+    grown.typeflags = (char *)(grown.mtimes + capacity);
+
+    if (list->count > 0) {
+        memcpy(grown.header_offsets, list->header_offsets, list->count * sizeof(int64_t));
+        memcpy(grown.data_offsets, list->data_offsets, list->count * sizeof(int64_t));
+        memcpy(grown.sizes, list->sizes, list->count * sizeof(uint64_t));
+        memcpy(grown.path_offsets, list->path_offsets, list->count * sizeof(size_t));
+        memcpy(grown.mtimes, list->mtimes, list->count * sizeof(unsigned));
+        memcpy(grown.typeflags, list->typeflags, list->count * sizeof(char));
+    }
+    tarchivist_release(list->allocator, list->header_offsets, list->capacity * TARCHIVIST_LIST_MEMBER_SIZE);
+
+    list->header_offsets = grown.header_offsets;
+    list->data_offsets = grown.data_offsets;
+    list->sizes = grown.sizes;
+    list->path_offsets = grown.path_offsets;
+    list->mtimes = grown.mtimes;
+    list->typeflags = grown.typeflags;
+    list->capacity = capacity;
+    return TARCHIVIST_SUCCESS;
+}
+
+static int tarchivist_list_insert(tarchivist_list_t *list, const char *prefix, const char *name, char typeflag, uint64_t size, unsigned mtime, int64_t header_pos, int64_t data_pos) {
+    const unsigned i = list->count;
+    size_t capacity;
+    unsigned length;
+    char *paths;
+    int err;
+
+    if (list->count == list->capacity) {
+        err = tarchivist_list_grow(list);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+    }
+
+    /* Path is assembled right in the pool, which has to fit the longest one possible */
+    if (list->paths_capacity - list->paths_size < TARCHIVIST_PATH_MAX) {
+        capacity = (list->paths_capacity > 0) ? (2 * list->paths_capacity) : TARCHIVIST_POOL_BLOCK_SIZE;
+        paths = tarchivist_resize(list->allocator, list->paths, list->paths_capacity, capacity);
+        if (paths == NULL) {
+            return TARCHIVIST_NOMEMORY;
+        }
+        list->paths = paths;
+        list->paths_capacity = capacity;
+    }
+    length = tarchivist_full_path(list->paths + list->paths_size, prefix, name);
+
+    /* Trailer is not a part of the archive content */
+    if (strcmp(list->paths + list->paths_size, TARCHIVIST_TRAILER_NAME) == 0) {
+        return TARCHIVIST_SUCCESS;
+    }
+
+    list->path_offsets[i] = list->paths_size;
+    list->header_offsets[i] = header_pos;
+    list->data_offsets[i] = data_pos;
+    list->sizes[i] = size;
+    list->mtimes[i] = mtime;
+    list->typeflags[i] = typeflag;
+    list->paths_size += length + 1;
+    list->count++;
+
+    return TARCHIVIST_SUCCESS;
+}
+
+int tarchivist_list_build(tarchivist_t *tar, tarchivist_list_t *list) {
+    tarchivist_raw_header_t storage;
+    const tarchivist_raw_header_t *raw_header;
+    tarchivist_iter_t iter;
+    int64_t pos, next_pos, data_pos;
+    uint64_t size;
+    int err;
+
+    if (tar == NULL || list == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    memset(list, 0, sizeof(tarchivist_list_t));
+    list->allocator = tar->allocator;
+
+    err = tarchivist_iter_init(tar, &iter);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    pos = iter.pos;
+    next_pos = iter.next_pos;
+
+    /* Header of the forward-only stream may have been consumed already */
+    if (tar->sequential && tar->header_valid) {
+        err = tarchivist_list_insert(list, tar->header.prefix, tar->header.name, tar->header.typeflag, tar->header.size, tar->header.mtime, tar->last_header_pos, tar->last_data_pos);
+        next_pos = tar->last_data_pos + (int64_t)tarchivist_round_up(tar->header.size, TARCHIVIST_TAR_BLOCK_SIZE);
+        tar->header_valid = false;
+        tar->bytes_left = 0;
+    }
+
+    /* Single pass, with only the listed fields decoded from each header */
+    while (err == TARCHIVIST_SUCCESS) {
+        if (tar->map == NULL && pos != next_pos) {
+            err = tarchivist_move(tar, pos, next_pos);
+            if (err != TARCHIVIST_SUCCESS) {
+                break;
+            }
+        }
+        pos = next_pos;
+
+        err = tarchivist_read_raw_member(tar, pos, &storage, &raw_header, &size, &data_pos);
+        if (err != TARCHIVIST_SUCCESS) {
+            break;
+        }
+        if (tar->map == NULL) {
+            pos = data_pos;
+        }
+
+        err = tarchivist_list_insert(list, raw_header->prefix, raw_header->name, raw_header->typeflag, size,
+                                     (unsigned)tarchivist_parse_octal(raw_header->mtime, sizeof(raw_header->mtime)), next_pos, data_pos);
+        next_pos = data_pos + (int64_t)tarchivist_round_up(size, TARCHIVIST_TAR_BLOCK_SIZE);
+    }
+
+    err = tarchivist_pass_end(tar, err, pos);
+    if (err != TARCHIVIST_SUCCESS) {
+        tarchivist_list_free(list);
+        return err;
+    }
+    return TARCHIVIST_SUCCESS;
+}
+
+const char *tarchivist_list_path(const tarchivist_list_t *list, unsigned i) {
+    if (list == NULL || i >= list->count) {
+        return NULL;
+    }
+    return list->paths + list->path_offsets[i];
+}
+
+void tarchivist_list_free(tarchivist_list_t *list) {
+    if (list == NULL) {
+        return;
+    }
+
+    tarchivist_release(list->allocator, list->header_offsets, list->capacity * TARCHIVIST_LIST_MEMBER_SIZE); /* Block holding all the arrays */
+    tarchivist_release(list->allocator, list->paths, list->paths_capacity);
+    memset(list, 0, sizeof(tarchivist_list_t));
+}
+
+/* Node of the prefix trie, children of a node are kept on a list */
+typedef struct tarchivist_trie_node_t {
+    struct tarchivist_trie_node_t *child;
+    struct tarchivist_trie_node_t *sibling;
+    unsigned id;      /* Pattern ending at this node, if any */
+    char c;
+} tarchivist_trie_node_t;
+
+static tarchivist_trie_node_t *tarchivist_trie_node_create(const tarchivist_allocator_t *allocator, char c) {
+    tarchivist_trie_node_t *node = tarchivist_alloc(allocator, sizeof(tarchivist_trie_node_t));
+    if (node != NULL) {
+        node->child = NULL;
+        node->sibling = NULL;
+        node->id = TARCHIVIST_NO_PATTERN;
+        node->c = c;
+    }
+    return node;
+}
+
+static void tarchivist_trie_free(const tarchivist_allocator_t *allocator, tarchivist_trie_node_t *node) {
+    tarchivist_trie_node_t *sibling;
+
+    /* Recursion only goes as deep as the longest prefix */
+    while (node != NULL) {
+        sibling = node->sibling;
+        tarchivist_trie_free(allocator, node->child);
+        tarchivist_release(allocator, node, sizeof(tarchivist_trie_node_t));
+        node = sibling;
+    }
+}
+
+static int tarchivist_trie_insert(tarchivist_matcher_t *matcher, const char *prefix, unsigned id) {
+    tarchivist_trie_node_t *node, *child;
+
+    if (matcher->trie == NULL) {
+        matcher->trie = tarchivist_trie_node_create(matcher->allocator, '\0');
+        if (matcher->trie == NULL) {
+            return TARCHIVIST_NOMEMORY;
+        }
+    }
+
+    for (node = matcher->trie; *prefix != '\0'; node = child, ++prefix) {
+        for (child = node->child; child != NULL && child->c != *prefix; child = child->sibling) {
+        }
+        if (child == NULL) {
+            child = tarchivist_trie_node_create(matcher->allocator, *prefix);
+            if (child == NULL) {
+                return TARCHIVIST_NOMEMORY;
+            }
+            child->sibling = node->child;
+            node->child = child;
+        }
+    }
+
+    /* Same prefix added again keeps its first number */
+    if (node->id == TARCHIVIST_NO_PATTERN) {
+        node->id = id;
+    }
+    return TARCHIVIST_SUCCESS;
+}
+
+/* Lowest number of the prefixes of the path */
+static unsigned tarchivist_trie_match(const tarchivist_trie_node_t *node, const char *path) {
+    unsigned id = TARCHIVIST_NO_PATTERN;
+
+    while (node != NULL) {
+        if (node->id < id) {
+            id = node->id;
+        }
+        if (*path == '\0') {
+            break;
+        }
+        for (node = node->child; node != NULL && node->c != *path; node = node->sibling) {
+        }
+        ++path;
+    }
+
+    return id;
+}
+
+/* Matches a bracket expression at the beginning of the pattern against c, returns the length of the expression
+ * or 0 if it's not terminated, in which case '[' is an ordinary character */
+static unsigned tarchivist_glob_bracket(const char *pattern, char c, bool *matched) {
+    const char *p = pattern + 1;
+    bool negated = false;
+
+    *matched = false;
+    if (*p == '!' || *p == '^') {
+        negated = true;
+        ++p;
+    }
+
+    /* Closing bracket right after the opening one is an ordinary character */
+    do {
+        if (*p == '\0') {
+            return 0;
+        }
+        if (p[1] == '-' && p[2] != ']' && p[2] != '\0') {
+            if ((uint8_t)p[0] <= (uint8_t)c && (uint8_t)c <= (uint8_t)p[2]) {
+                *matched = true;
+            }
+            p += 3;
+        }
+        else {
+            if (*p == c) {
+                *matched = true;
+            }
+            ++p;
+        }
+    } while (*p != ']');
+
+    *matched = (*matched != negated);
+    return (unsigned)(p - pattern) + 1;
+}
+
+/* Shell wildcard match, the last '*' is backtracked to when the rest doesn't match */
+static bool tarchivist_glob_match(const char *pattern, const char *path) {
+    const char *star = NULL, *resume = NULL;
+    unsigned length;
+    bool matched;
+
+    while (*path != '\0') {
+        if (*pattern == '*') {
+            star = ++pattern;
+            resume = path;
+            continue;
+        }
+
+        if (*pattern == '?') {
+            length = 1;
+            matched = true;
+        }
+        else if (*pattern == '[') {
+            length = tarchivist_glob_bracket(pattern, *path, &matched);
+            if (length == 0) {
+                length = 1;
+                matched = (*path == '[');
+            }
+        }
+        else if (*pattern == '\\' && pattern[1] != '\0') {
+            length = 2;
+            matched = (pattern[1] == *path);
+        }
+        else {
+            length = 1;
+            matched = (*pattern != '\0' && *pattern == *path);
+        }
+
+        if (matched) {
+            pattern += length;
+            ++path;
+        }
+        else if (star != NULL) {
+            pattern = star;
+            path = ++resume;
+        }
+        else {
+            return false;
+        }
+    }
+
+    while (*pattern == '*') {
+        ++pattern;
+    }
+    return *pattern == '\0';
+}
+
+static unsigned *tarchivist_matcher_bucket(const tarchivist_matcher_t *matcher, const char *path, unsigned length, char ***slot) {
+    const unsigned mask = matcher->bucket_count - 1;
+    unsigned i = tarchivist_hash(path, length) & mask;
+
+    /* Linear probing until either the path or an empty bucket is found */
+    while (matcher->exact[i] != NULL && strcmp(matcher->exact[i], path) != 0) {
+        i = (i + 1) & mask;
+    }
+
+    *slot = &matcher->exact[i];
+    return &matcher->exact_ids[i];
+}
+
+static int tarchivist_matcher_grow(tarchivist_matcher_t *matcher) {
+    const unsigned bucket_count = (matcher->bucket_count > 0) ? (2 * matcher->bucket_count) : (2 * TARCHIVIST_MATCHER_MIN_CAPACITY);
+    tarchivist_matcher_t grown;
+    char **slot;
+    unsigned i;
+
+    grown.exact = tarchivist_alloc(matcher->allocator, bucket_count * sizeof(char *));
+    grown.exact_ids = tarchivist_alloc(matcher->allocator, bucket_count * sizeof(unsigned));
+    if (grown.exact == NULL || grown.exact_ids == NULL) {
+        tarchivist_release(matcher->allocator, grown.exact_ids, bucket_count * sizeof(unsigned));
+        tarchivist_release(matcher->allocator, grown.exact, bucket_count * sizeof(char *));
+        return TARCHIVIST_NOMEMORY;
     }
+    memset(grown.exact, 0, bucket_count * sizeof(char *));
+    grown.bucket_count = bucket_count;
 
-    path_length = strlen(path);
+    /* Rehash already stored paths */
+    for (i = 0; i < matcher->bucket_count; ++i) {
+        if (matcher->exact[i] != NULL) {
+            *tarchivist_matcher_bucket(&grown, matcher->exact[i], strlen(matcher->exact[i]), &slot) = matcher->exact_ids[i];
+            *slot = matcher->exact[i];
+        }
+    }
 
-    /* Case where path is stored in the prefix field */
-    if (path_length > sizeof(header->name)) {
-        /* Extract file name */
-        name = strrchr(path, '/');
+    tarchivist_release(matcher->allocator, matcher->exact_ids, matcher->bucket_count * sizeof(unsigned));
+    tarchivist_release(matcher->allocator, matcher->exact, matcher->bucket_count * sizeof(char *));
+    matcher->exact = grown.exact;
+    matcher->exact_ids = grown.exact_ids;
+    matcher->bucket_count = bucket_count;
+    return TARCHIVIST_SUCCESS;
+}
 
-        /* Pure filename longer than 100 chars, cannot be stored in USTAR archive */
-        if (name == NULL) {
-            return TARCHIVIST_NULLRECORD;
+static int tarchivist_matcher_add_exact(tarchivist_matcher_t *matcher, const char *path, unsigned id) {
+    const unsigned length = strlen(path);
+    unsigned *bucket_id;
+    char **slot;
+    int err;
+
+    /* Keep the load factor at most 0.5 */
+    if (2 * (matcher->exact_count + 1) > matcher->bucket_count) {
+        err = tarchivist_matcher_grow(matcher);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
         }
+    }
 
-        /* Compute lengths */
-        name++; /* Skip slash */
-        name_length = strlen(name);
-        prefix_length = path_length - name_length - 1;
+    bucket_id = tarchivist_matcher_bucket(matcher, path, length, &slot);
+    if (*slot != NULL) {
+        return TARCHIVIST_SUCCESS; /* Same path added again keeps its first number */
+    }
 
-        /* This path cannot be stored in USTAR archive */
-        if (name_length > sizeof(header->name) || prefix_length > sizeof(header->prefix)) {
-            return TARCHIVIST_NULLRECORD;
-        }
+    *slot = tarchivist_alloc(matcher->allocator, length + 1);
+    if (*slot == NULL) {
+        return TARCHIVIST_NOMEMORY;
     }
+    memcpy(*slot, path, length + 1);
+    *bucket_id = id;
+    matcher->exact_count++;
 
-    /* Iterate until there's nothing left to read */
-    while ((err = tarchivist_read_header(tar, header)) == TARCHIVIST_SUCCESS) {
-        if (path_length <= sizeof(header->name)) {
-            if (strcmp(path, header->name) == 0) {
-                break;
-            }
+    return TARCHIVIST_SUCCESS;
+}
+
+static int tarchivist_matcher_add_glob(tarchivist_matcher_t *matcher, const char *pattern, unsigned id) {
+    const size_t length = strlen(pattern);
+    unsigned capacity;
+    char **globs;
+    unsigned *glob_ids;
+
+    if (matcher->glob_count == matcher->glob_capacity) {
+        capacity = (matcher->glob_capacity > 0) ? (2 * matcher->glob_capacity) : TARCHIVIST_MATCHER_MIN_CAPACITY;
+        globs = tarchivist_resize(matcher->allocator, matcher->globs, matcher->glob_capacity * sizeof(char *), capacity * sizeof(char *));
+        if (globs == NULL) {
+            return TARCHIVIST_NOMEMORY;
         }
-        else {
-            if (strncmp(path, header->prefix, prefix_length) == 0 && strcmp(name, header->name) == 0) {
-                break;
-            }
+        matcher->globs = globs;
+        glob_ids = tarchivist_resize(matcher->allocator, matcher->glob_ids, matcher->glob_capacity * sizeof(unsigned), capacity * sizeof(unsigned));
+        if (glob_ids == NULL) {
+            return TARCHIVIST_NOMEMORY;
         }
+        matcher->glob_ids = glob_ids;
+        matcher->glob_capacity = capacity;
+    }
 
-        tarchivist_next(tar);
+    matcher->globs[matcher->glob_count] = tarchivist_alloc(matcher->allocator, length + 1);
+    if (matcher->globs[matcher->glob_count] == NULL) {
+        return TARCHIVIST_NOMEMORY;
     }
+    memcpy(matcher->globs[matcher->glob_count], pattern, length + 1);
+    matcher->glob_ids[matcher->glob_count] = id;
+    matcher->glob_count++;
 
-    if (err == TARCHIVIST_NULLRECORD) {
-        return TARCHIVIST_NOTFOUND;
+    return TARCHIVIST_SUCCESS;
+}
+
+/* Lowest number of the patterns matching the path */
+static unsigned tarchivist_matcher_match(const tarchivist_matcher_t *matcher, const char *path, unsigned length) {
+    unsigned id = TARCHIVIST_NO_PATTERN, prefix_id, i;
+    char **slot;
+
+    if (matcher->exact_count > 0) {
+        i = *tarchivist_matcher_bucket(matcher, path, length, &slot);
+        if (*slot != NULL) {
+            id = i;
+        }
     }
-    return err;
+
+    prefix_id = tarchivist_trie_match(matcher->trie, path);
+    if (prefix_id < id) {
+        id = prefix_id;
+    }
+
+    /* Globs are checked in the order of numbers, so only the ones added earlier can lower it */
+    for (i = 0; i < matcher->glob_count && matcher->glob_ids[i] < id; ++i) {
+        if (tarchivist_glob_match(matcher->globs[i], path)) {
+            id = matcher->glob_ids[i];
+        }
+    }
+
+    return id;
 }
 
-int tarchivist_read_header(tarchivist_t *tar, tarchivist_header_t *header) {
-    tarchivist_raw_header_t raw_header;
-    int read_status, seek_status;
+int tarchivist_matcher_init(tarchivist_matcher_t *matcher, const tarchivist_allocator_t *allocator) {
+    if (matcher == NULL || (allocator != NULL && (allocator->alloc == NULL || allocator->resize == NULL || allocator->release == NULL))) {
+        return TARCHIVIST_FAILURE;
+    }
 
-    if (tar == NULL || header == NULL) {
+    memset(matcher, 0, sizeof(tarchivist_matcher_t));
+    matcher->allocator = allocator;
+    return TARCHIVIST_SUCCESS;
+}
+
+int tarchivist_matcher_add(tarchivist_matcher_t *matcher, const char *pattern, int kind) {
+    int err;
+
+    if (matcher == NULL || pattern == NULL) {
         return TARCHIVIST_FAILURE;
     }
 
-    /* Save last header position */
-    tar->last_header_pos = tar->tell(tar);
+    switch (kind) {
+        case TARCHIVIST_MATCH_EXACT:
+            err = tarchivist_matcher_add_exact(matcher, pattern, matcher->count);
+            break;
+        case TARCHIVIST_MATCH_PREFIX:
+            err = tarchivist_trie_insert(matcher, pattern, matcher->count);
+            break;
+        case TARCHIVIST_MATCH_GLOB:
+            err = tarchivist_matcher_add_glob(matcher, pattern, matcher->count);
+            break;
+        default:
+            return TARCHIVIST_FAILURE;
+    }
 
-    /* Read the header */
-    read_status = tar->read(tar, sizeof(tarchivist_raw_header_t), &raw_header);
+    if (err == TARCHIVIST_SUCCESS) {
+        matcher->count++;
+    }
+    return err;
+}
 
-    /* Go back to the beginning of the header */
-    seek_status = tar->seek(tar, tar->last_header_pos, TARCHIVIST_SEEK_SET);
+void tarchivist_matcher_free(tarchivist_matcher_t *matcher) {
+    unsigned i;
 
-    /* Report status */
-    if (read_status != TARCHIVIST_SUCCESS) {
-        return read_status;
+    if (matcher == NULL) {
+        return;
+    }
+
+    /* Given back in reverse order of allocation as far as possible, for the sake of the arena */
+    for (i = matcher->glob_count; i > 0; --i) {
+        tarchivist_release(matcher->allocator, matcher->globs[i - 1], strlen(matcher->globs[i - 1]) + 1);
     }
-    if (seek_status != TARCHIVIST_SUCCESS) {
-        return seek_status;
+    for (i = 0; i < matcher->bucket_count; ++i) {
+        if (matcher->exact[i] != NULL) {
+            tarchivist_release(matcher->allocator, matcher->exact[i], strlen(matcher->exact[i]) + 1);
+        }
     }
-    return tarchivist_raw_to_header(header, &raw_header);
+    tarchivist_trie_free(matcher->allocator, matcher->trie);
+    tarchivist_release(matcher->allocator, matcher->glob_ids, matcher->glob_capacity * sizeof(unsigned));
+    tarchivist_release(matcher->allocator, matcher->globs, matcher->glob_capacity * sizeof(char *));
+    tarchivist_release(matcher->allocator, matcher->exact_ids, matcher->bucket_count * sizeof(unsigned));
+    tarchivist_release(matcher->allocator, matcher->exact, matcher->bucket_count * sizeof(char *));
+    memset(matcher, 0, sizeof(tarchivist_matcher_t));
 }
 
-long tarchivist_read_data(tarchivist_t *tar, unsigned size, void *data) {
+int tarchivist_find_batch(tarchivist_t *tar, const tarchivist_matcher_t *matcher, tarchivist_match_callback_t callback, void *ctx) {
+    tarchivist_raw_header_t storage;
+    const tarchivist_raw_header_t *raw_header;
     tarchivist_header_t header;
+    tarchivist_match_t match;
+    tarchivist_iter_t iter;
+    char path[TARCHIVIST_PATH_MAX];
+    unsigned length, pattern;
+    uint64_t size, consumed;
+    int64_t data_pos;
     int err;
 
-    if (tar == NULL || data == NULL) {
+    if (tar == NULL || matcher == NULL || callback == NULL) {
         return TARCHIVIST_FAILURE;
     }
 
-    /* If no bytes left to read then this is the first read, obtain the
-     * size from the header and go to the beginning of the data */
-    if (tar->bytes_left == 0) {
-        err = tarchivist_read_header(tar, &header);
-        if (err != TARCHIVIST_SUCCESS) {
-            return err;
+    err = tarchivist_iter_init(tar, &iter);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+
+    /* Single pass, the whole header is decoded only for the members matched */
+    while (true) {
+        if (tar->sequential && tar->header_valid && iter.next_pos == tar->last_header_pos) {
+            /* Header of the forward-only stream was consumed before the search started */
+            memcpy(&header, &tar->header, sizeof(tarchivist_header_t));
+            tar->header_valid = false;
+            raw_header = NULL;
+            size = header.size;
+            data_pos = tar->last_data_pos;
+            consumed = (uint64_t)(iter.pos - data_pos);
+            length = tarchivist_full_path(path, header.prefix, header.name);
         }
-        tar->bytes_left = header.size;
+        else {
+            if (tar->map == NULL && iter.pos != iter.next_pos) {
+                err = tarchivist_move(tar, iter.pos, iter.next_pos);
+                if (err != TARCHIVIST_SUCCESS) {
+                    break;
+                }
+                iter.pos = iter.next_pos;
+            }
+            tarchivist_cache_release(tar, iter.pos, false);
+
+            consumed = 0;
+            err = tarchivist_read_raw_member(tar, iter.next_pos, &storage, &raw_header, &size, &data_pos);
+            if (err != TARCHIVIST_SUCCESS) {
+                tarchivist_track_pos(tar, -1); /* Position unknown after failed read */
+                break;
+            }
+            if (tar->map == NULL) {
+                iter.pos = data_pos;
+                tarchivist_track_pos(tar, data_pos);
+            }
+            length = tarchivist_full_path(path, raw_header->prefix, raw_header->name);
+        }
+
+        iter.header_pos = iter.next_pos;
+        iter.data_pos = data_pos;
+        iter.next_pos = data_pos + (int64_t)tarchivist_round_up(size, TARCHIVIST_TAR_BLOCK_SIZE);
+        iter.size = size;
+        iter.bytes_left = size - consumed;
+        tar->last_header_pos = iter.header_pos;
+        tar->last_data_pos = iter.data_pos;
+
+        pattern = tarchivist_matcher_match(matcher, path, length);
+        if (pattern == TARCHIVIST_NO_PATTERN || strcmp(path, TARCHIVIST_TRAILER_NAME) == 0) {
+            continue;
+        }
+
+        if (raw_header != NULL) {
+            tarchivist_decode_raw_header(&header, raw_header);
+            header.size = size;
+        }
+        match.path = path;
+        match.header = &header;
+        match.header_offset = iter.header_pos;
+        match.data_offset = iter.data_pos;
+        match.pattern = pattern;
+        match.iter = &iter;
 
-        err = tar->seek(tar, tar->tell(tar) + sizeof(tarchivist_raw_header_t), TARCHIVIST_SEEK_SET);
+        err = callback(ctx, &match);
         if (err != TARCHIVIST_SUCCESS) {
             return err;
         }
     }
 
-    /* If requested to read more than left to read */
-    if (tar->bytes_left < size) {
-        size = tar->bytes_left;
+    return tarchivist_pass_end(tar, err, iter.next_pos);
+}
+
+int tarchivist_gen_init(tarchivist_gen_t *gen, const tarchivist_allocator_t *allocator) {
+    if (gen == NULL || (allocator != NULL && (allocator->alloc == NULL || allocator->resize == NULL || allocator->release == NULL))) {
+        return TARCHIVIST_FAILURE;
     }
 
-    /* Read data */
-    err = tar->read(tar, size, data);
-    if (err != TARCHIVIST_SUCCESS) {
-        return err;
+    memset(gen, 0, sizeof(tarchivist_gen_t));
+    gen->allocator = allocator;
+    return TARCHIVIST_SUCCESS;
+}
+
+static int tarchivist_gen_enqueue(tarchivist_gen_t *gen, const tarchivist_header_t *header, tarchivist_source_t source, void *ctx, int fd) {
+    tarchivist_gen_member_t *member;
+
+    if (gen->finished) {
+        return TARCHIVIST_FAILURE;
     }
-    tar->bytes_left -= size;
 
-    /* If no data left, rewind back to the beginning of the record */
-    if (tar->bytes_left == 0) {
-        err = tar->seek(tar, tar->last_header_pos, TARCHIVIST_SEEK_SET);
-        if (err != TARCHIVIST_SUCCESS) {
-            return err;
+    /* Members already produced are reused, so a steady stream of them allocates nothing */
+    if (gen->spare != NULL) {
+        member = gen->spare;
+        gen->spare = member->next;
+    }
+    else {
+        member = tarchivist_alloc(gen->allocator, sizeof(tarchivist_gen_member_t));
+        if (member == NULL) {
+            return TARCHIVIST_NOMEMORY;
         }
     }
+    member->next = NULL;
+    memcpy(&member->header, header, sizeof(tarchivist_header_t));
+    member->source = source;
+    member->ctx = ctx;
+    member->fd = fd;
 
-    /* If no errors, return real read size */
-    return size;
+    if (gen->tail != NULL) {
+        gen->tail->next = member;
+    }
+    else {
+        gen->head = member;
+    }
+    gen->tail = member;
+
+    return TARCHIVIST_SUCCESS;
 }
 
-int tarchivist_write_header(tarchivist_t *tar, const tarchivist_header_t *header) {
-    tarchivist_raw_header_t raw_header;
+int tarchivist_gen_add(tarchivist_gen_t *gen, const tarchivist_header_t *header, tarchivist_source_t source, void *ctx) {
+    if (gen == NULL || header == NULL || (source == NULL && header->size > 0)) {
+        return TARCHIVIST_FAILURE;
+    }
+    return tarchivist_gen_enqueue(gen, header, source, ctx, -1);
+}
 
-    if (tar == NULL || header == NULL) {
+int tarchivist_gen_add_fd(tarchivist_gen_t *gen, const tarchivist_header_t *header, int fd) {
+    if (gen == NULL || header == NULL || fd < 0) {
         return TARCHIVIST_FAILURE;
     }
+#ifdef TARCHIVIST_POSIX
+    return tarchivist_gen_enqueue(gen, header, NULL, NULL, fd);
+#else
+    return TARCHIVIST_NOTSUPPORTED;
+#endif
+}
+
+int tarchivist_gen_finish(tarchivist_gen_t *gen) {
+    if (gen == NULL) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    gen->finished = true;
+    return TARCHIVIST_SUCCESS;
+}
+
+static void tarchivist_gen_release(tarchivist_gen_t *gen, tarchivist_gen_member_t *member) {
+#ifdef TARCHIVIST_POSIX
+    if (member->source == NULL && member->fd >= 0) {
+        close(member->fd);
+    }
+#endif
+    member->next = gen->spare;
+    gen->spare = member;
+}
+
+/* Stages the headers of the member at the head of the queue */
+static void tarchivist_gen_begin_member(tarchivist_gen_t *gen) {
+    const tarchivist_header_t *header = &gen->head->header;
+    tarchivist_raw_header_t raw_header;
 
-    /* Prepare raw header */
     tarchivist_header_to_raw(&raw_header, header);
-    tar->bytes_left = header->size; /* Store size to know how many bytes of data has to be written */
-    return tar->write(tar, sizeof(tarchivist_raw_header_t), &raw_header);
+    gen->staged = 0;
+    if (header->size > TARCHIVIST_OCTAL_SIZE_MAX) {
+        tarchivist_pax_header_init((tarchivist_raw_header_t *)gen->staging, (char *)gen->staging + TARCHIVIST_TAR_BLOCK_SIZE, &raw_header, header->size);
+        gen->staged = 2 * TARCHIVIST_TAR_BLOCK_SIZE;
+    }
+    memcpy(gen->staging + gen->staged, &raw_header, sizeof(raw_header));
+    gen->staged += sizeof(raw_header);
+    gen->staged_pos = 0;
+
+    gen->bytes_left = header->size;
+    gen->pad_left = (unsigned)(tarchivist_round_up(header->size, TARCHIVIST_TAR_BLOCK_SIZE) - header->size);
+    gen->in_member = true;
 }
 
-long tarchivist_write_data(tarchivist_t *tar, unsigned size, const void *data) {
-    unsigned pad_size;
-    long pos;
-    int err;
-    char *zeros;
+static long tarchivist_gen_read_data(tarchivist_gen_member_t *member, void *data, unsigned size) {
+#ifdef TARCHIVIST_POSIX
+    ssize_t read_size;
 
-    if (tar == NULL || data == NULL) {
+    if (member->source == NULL) {
+        read_size = read(member->fd, data, size);
+        return (read_size >= 0) ? (long)read_size : TARCHIVIST_READFAIL;
+    }
+#endif
+    return member->source(member->ctx, data, size);
+}
+
+long tarchivist_gen_fill(tarchivist_gen_t *gen, void *buffer, unsigned size) {
+    uint8_t *const data = buffer;
+    tarchivist_gen_member_t *member;
+    unsigned filled = 0, chunk_size;
+    long read_size;
+
+    if (gen == NULL || (buffer == NULL && size > 0)) {
         return TARCHIVIST_FAILURE;
     }
 
-    /* If requested to write more than left to write */
-    if (tar->bytes_left < size) {
-        size = tar->bytes_left;
+    while (filled < size && !gen->done) {
+        /* Headers of the current member or the closing record */
+        if (gen->staged_pos < gen->staged) {
+            chunk_size = gen->staged - gen->staged_pos;
+            if (chunk_size > size - filled) {
+                chunk_size = size - filled;
+            }
+            memcpy(data + filled, gen->staging + gen->staged_pos, chunk_size);
+            gen->staged_pos += chunk_size;
+            filled += chunk_size;
+            gen->done = (gen->closing && gen->staged_pos == gen->staged);
+        }
+        /* Data of the current member, straight into the caller's buffer */
+        else if (gen->bytes_left > 0) {
+            chunk_size = (gen->bytes_left < size - filled) ? (unsigned)gen->bytes_left : (size - filled);
+            read_size = tarchivist_gen_read_data(gen->head, data + filled, chunk_size);
+            if (read_size < 0) {
+                return read_size;
+            }
+            if (read_size == 0 || (unsigned long)read_size > chunk_size) {
+                return TARCHIVIST_READFAIL; /* Source ended before the size given in the header */
+            }
+            gen->bytes_left -= (uint64_t)read_size;
+            filled += (unsigned)read_size;
+        }
+        else if (gen->pad_left > 0) {
+            chunk_size = (gen->pad_left < size - filled) ? gen->pad_left : (size - filled);
+            memset(data + filled, 0, chunk_size);
+            gen->pad_left -= chunk_size;
+            filled += chunk_size;
+        }
+        /* Member complete, drop it from the queue */
+        else if (gen->in_member) {
+            member = gen->head;
+            gen->head = member->next;
+            if (gen->head == NULL) {
+                gen->tail = NULL;
+            }
+            tarchivist_gen_release(gen, member);
+            gen->in_member = false;
+        }
+        else if (gen->head != NULL) {
+            tarchivist_gen_begin_member(gen);
+        }
+        else if (gen->finished) {
+            memset(gen->staging, 0, TARCHIVIST_CLOSING_RECORD_SIZE);
+            gen->staged = TARCHIVIST_CLOSING_RECORD_SIZE;
+            gen->staged_pos = 0;
+            gen->closing = true;
+        }
+        else {
+            break; /* Waiting for more members */
+        }
     }
 
-    /* Write data */
-    err = tar->write(tar, size, data);
-    if (err != TARCHIVIST_SUCCESS) {
-        return err;
+    return filled;
+}
+
+void tarchivist_gen_free(tarchivist_gen_t *gen) {
+    tarchivist_gen_member_t *member;
+
+    if (gen == NULL) {
+        return;
     }
-    tar->bytes_left -= size;
 
-    /* Pad with zeros to multiple of a block size */
-    pos = tar->tell(tar);
-    pad_size = tarchivist_round_up(pos, TARCHIVIST_TAR_BLOCK_SIZE) - pos;
+    while (gen->head != NULL) {
+        member = gen->head;
+        gen->head = member->next;
+        tarchivist_gen_release(gen, member);
+    }
+    gen->tail = NULL;
 
-    /* If no padding required, job done */
-    if (pad_size == 0) {
-        return size;
+    while (gen->spare != NULL) {
+        member = gen->spare;
+        gen->spare = member->next;
+        tarchivist_release(gen->allocator, member, sizeof(tarchivist_gen_member_t));
     }
+}
 
-    zeros = calloc(1, pad_size);
-    if (zeros == NULL) {
-        return TARCHIVIST_NOMEMORY;
+enum tarchivist_parser_state_e {
+    TARCHIVIST_PARSE_HEADER = 0,
+    TARCHIVIST_PARSE_PAX,
+    TARCHIVIST_PARSE_DATA,
+    TARCHIVIST_PARSE_PADDING,
+    TARCHIVIST_PARSE_END
+};
+
+int tarchivist_parser_init(tarchivist_parser_t *parser, const tarchivist_parser_callbacks_t *callbacks, void *ctx, const tarchivist_allocator_t *allocator) {
+    if (parser == NULL || callbacks == NULL || (allocator != NULL && (allocator->alloc == NULL || allocator->resize == NULL || allocator->release == NULL))) {
+        return TARCHIVIST_FAILURE;
+    }
+
+    memset(parser, 0, sizeof(tarchivist_parser_t));
+    memcpy(&parser->callbacks, callbacks, sizeof(tarchivist_parser_callbacks_t));
+    parser->ctx = ctx;
+    parser->allocator = allocator;
+    parser->state = TARCHIVIST_PARSE_HEADER;
+    return TARCHIVIST_SUCCESS;
+}
+
+static void tarchivist_parser_release_pax(tarchivist_parser_t *parser) {
+    if (parser->pax != parser->pax_buffer) {
+        tarchivist_release(parser->allocator, parser->pax, parser->pax_size);
     }
+    parser->pax = NULL;
+}
+
+static int tarchivist_parser_member_end(tarchivist_parser_t *parser) {
+    parser->state = (parser->pad_left > 0) ? TARCHIVIST_PARSE_PADDING : TARCHIVIST_PARSE_HEADER;
+    return (parser->callbacks.member_end != NULL) ? parser->callbacks.member_end(parser->ctx) : TARCHIVIST_SUCCESS;
+}
 
-    err = tar->write(tar, pad_size, zeros);
+static int tarchivist_parser_header(tarchivist_parser_t *parser, const tarchivist_raw_header_t *raw_header) {
+    tarchivist_header_t header;
+    uint64_t pax_size;
+    int err;
+
+    err = tarchivist_raw_to_header(&header, raw_header);
+    if (err == TARCHIVIST_NULLRECORD) {
+        parser->state = TARCHIVIST_PARSE_END;
+        parser->done = true;
+        return (parser->callbacks.archive_end != NULL) ? parser->callbacks.archive_end(parser->ctx) : TARCHIVIST_SUCCESS;
+    }
     if (err != TARCHIVIST_SUCCESS) {
-        free(zeros);
         return err;
     }
 
-    free(zeros);
-    return size;
+    /* Extended header is collected whole and applied to the member that follows it */
+    if (header.typeflag == TARCHIVIST_PAX) {
+        pax_size = tarchivist_round_up(header.size, TARCHIVIST_TAR_BLOCK_SIZE);
+        if (pax_size > TARCHIVIST_PAX_SIZE_MAX) {
+            return TARCHIVIST_NOTSUPPORTED;
+        }
+        if (pax_size > 0) {
+            /* Just as in the pull path, only the extended headers not fitting the buffer get allocated */
+            parser->pax = (pax_size > sizeof(parser->pax_buffer)) ? tarchivist_alloc(parser->allocator, pax_size) : parser->pax_buffer;
+            if (parser->pax == NULL) {
+                return TARCHIVIST_NOMEMORY;
+            }
+            parser->pax_size = (unsigned)pax_size;
+            parser->pax_used = 0;
+            parser->state = TARCHIVIST_PARSE_PAX;
+        }
+        return TARCHIVIST_SUCCESS;
+    }
+
+    /* Global extended header is skipped just as in the pull path, the same way the padding is */
+    if (header.typeflag == TARCHIVIST_GLOBAL) {
+        pax_size = tarchivist_round_up(header.size, TARCHIVIST_TAR_BLOCK_SIZE);
+        if (pax_size > TARCHIVIST_PAX_SIZE_MAX) {
+            return TARCHIVIST_NOTSUPPORTED;
+        }
+        parser->pad_left = (unsigned)pax_size;
+        parser->state = (pax_size > 0) ? TARCHIVIST_PARSE_PADDING : TARCHIVIST_PARSE_HEADER;
+        return TARCHIVIST_SUCCESS;
+    }
+
+    if (parser->has_pax_size) {
+        header.size = parser->pax_value;
+        parser->has_pax_size = false;
+    }
+    parser->bytes_left = header.size;
+    parser->pad_left = (unsigned)(tarchivist_round_up(header.size, TARCHIVIST_TAR_BLOCK_SIZE) - header.size);
+    parser->state = TARCHIVIST_PARSE_DATA;
+
+    if (parser->callbacks.header != NULL) {
+        err = parser->callbacks.header(parser->ctx, &header);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+    }
+
+    /* Member without data ends right away */
+    if (parser->bytes_left == 0) {
+        return tarchivist_parser_member_end(parser);
+    }
+    return TARCHIVIST_SUCCESS;
 }
 
-int tarchivist_close(tarchivist_t *tar) {
-    char *zeros;
-    int err;
+int tarchivist_parser_feed(tarchivist_parser_t *parser, const void *data, unsigned size) {
+    const uint8_t *bytes = data;
+    unsigned chunk_size;
+    int err = TARCHIVIST_SUCCESS;
 
-    if (tar == NULL || tar->stream == NULL) {
+    if (parser == NULL || (data == NULL && size > 0)) {
         return TARCHIVIST_FAILURE;
     }
+    if (parser->err != TARCHIVIST_SUCCESS) {
+        return parser->err;
+    }
 
-    /* Finalize the archive if required */
-    if (tar->finalize) {
-        zeros = calloc(1, TARCHIVIST_CLOSING_RECORD_SIZE);
-        if (zeros == NULL) {
-            return TARCHIVIST_NOMEMORY;
+    /* Anything following the end of the archive (the other null block, record padding) is ignored */
+    while (size > 0 && parser->state != TARCHIVIST_PARSE_END) {
+        switch (parser->state) {
+            case TARCHIVIST_PARSE_HEADER:
+                /* Whole header in the chunk is decoded in place, otherwise it's assembled from the pieces */
+                if (parser->block_used == 0 && size >= TARCHIVIST_TAR_BLOCK_SIZE) {
+                    chunk_size = TARCHIVIST_TAR_BLOCK_SIZE;
+                    err = tarchivist_parser_header(parser, (const tarchivist_raw_header_t *)bytes);
+                }
+                else {
+                    chunk_size = TARCHIVIST_TAR_BLOCK_SIZE - parser->block_used;
+                    if (chunk_size > size) {
+                        chunk_size = size;
+                    }
+                    memcpy(parser->block + parser->block_used, bytes, chunk_size);
+                    parser->block_used += chunk_size;
+                    if (parser->block_used == TARCHIVIST_TAR_BLOCK_SIZE) {
+                        parser->block_used = 0;
+                        err = tarchivist_parser_header(parser, (const tarchivist_raw_header_t *)parser->block);
+                    }
+                }
+                break;
+
+            case TARCHIVIST_PARSE_PAX:
+                chunk_size = parser->pax_size - parser->pax_used;
+                if (chunk_size > size) {
+                    chunk_size = size;
+                }
+                memcpy(parser->pax + parser->pax_used, bytes, chunk_size);
+                parser->pax_used += chunk_size;
+
+                if (parser->pax_used == parser->pax_size) {
+                    /* Records end at the first null byte, so the padding doesn't get in the way */
+                    parser->has_pax_size = false;
+                    err = tarchivist_pax_parse(parser->pax, parser->pax_size, &parser->pax_value, &parser->has_pax_size);
+                    tarchivist_parser_release_pax(parser);
+                    parser->state = TARCHIVIST_PARSE_HEADER;
+                }
+                break;
+
+            case TARCHIVIST_PARSE_DATA:
+                chunk_size = (parser->bytes_left < size) ? (unsigned)parser->bytes_left : size;
+                if (parser->callbacks.data != NULL) {
+                    err = parser->callbacks.data(parser->ctx, bytes, chunk_size);
+                }
+                parser->bytes_left -= chunk_size;
+                if (err == TARCHIVIST_SUCCESS && parser->bytes_left == 0) {
+                    err = tarchivist_parser_member_end(parser);
+                }
+                break;
+
+            case TARCHIVIST_PARSE_PADDING:
+                chunk_size = (parser->pad_left < size) ? parser->pad_left : size;
+                parser->pad_left -= chunk_size;
+                if (parser->pad_left == 0) {
+                    parser->state = TARCHIVIST_PARSE_HEADER;
+                }
+                break;
+
+            default:
+                err = TARCHIVIST_FAILURE;
+                chunk_size = size;
+                break;
         }
 
-        err = tar->write(tar, TARCHIVIST_CLOSING_RECORD_SIZE, zeros);
         if (err != TARCHIVIST_SUCCESS) {
-            free(zeros);
+            parser->err = err;
             return err;
         }
+        bytes += chunk_size;
+        size -= chunk_size;
+    }
 
-        free(zeros);
+    return TARCHIVIST_SUCCESS;
+}
+
+void tarchivist_parser_free(tarchivist_parser_t *parser) {
+    if (parser == NULL) {
+        return;
     }
 
-    return tar->close(tar);
+    tarchivist_parser_release_pax(parser);
 }
 
 const char *tarchivist_strerror(int error_code) {
@@ -588,6 +5005,8 @@ const char *tarchivist_strerror(int error_code) {
             return "record not found";   
         case TARCHIVIST_NOMEMORY:
             return "no memory left";  
+        case TARCHIVIST_NOTSUPPORTED:
+            return "operation not supported";
         default:
             return "unknown"; 
     }
@@ -13,15 +13,18 @@
 #include <stdio.h>
 #include <time.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #define TARCHIVIST_TAR_BLOCK_SIZE 512
+#define TARCHIVIST_DEFAULT_BUFFER_SIZE (20 * TARCHIVIST_TAR_BLOCK_SIZE) /* Same as GNU tar's default record */
+#define TARCHIVIST_MEM_CHUNK_SIZE (64 * 1024) /* Default size of the first chunk of the archive written to memory */
 
 typedef struct tarchivist_header_t {
     char name[100];
     unsigned mode;
     unsigned uid;
     unsigned gid;
-    unsigned size;
+    uint64_t size;
     unsigned mtime;
     char typeflag;
     char linkname[100];
@@ -33,17 +36,18 @@ typedef struct tarchivist_header_t {
 } tarchivist_header_t;
 
 enum tarchivist_error_e {
-    TARCHIVIST_SUCCESS    =  0,
-    TARCHIVIST_FAILURE    = -1,
-    TARCHIVIST_OPENFAIL   = -2,
-    TARCHIVIST_READFAIL   = -3,
-    TARCHIVIST_WRITEFAIL  = -4,
-    TARCHIVIST_SEEKFAIL   = -5,
-    TARCHIVIST_CLOSEFAIL  = -6,
-    TARCHIVIST_BADCHKSUM  = -7,
-    TARCHIVIST_NULLRECORD = -8,
-    TARCHIVIST_NOTFOUND   = -9,
-    TARCHIVIST_NOMEMORY   = -10
+    TARCHIVIST_SUCCESS      =  0,
+    TARCHIVIST_FAILURE      = -1,
+    TARCHIVIST_OPENFAIL     = -2,
+    TARCHIVIST_READFAIL     = -3,
+    TARCHIVIST_WRITEFAIL    = -4,
+    TARCHIVIST_SEEKFAIL     = -5,
+    TARCHIVIST_CLOSEFAIL    = -6,
+    TARCHIVIST_BADCHKSUM    = -7,
+    TARCHIVIST_NULLRECORD   = -8,
+    TARCHIVIST_NOTFOUND     = -9,
+    TARCHIVIST_NOMEMORY     = -10,
+    TARCHIVIST_NOTSUPPORTED = -11
 };
 
 enum tarchivist_record_e {
@@ -55,7 +59,22 @@ enum tarchivist_record_e {
     TARCHIVIST_BLKDEV   =  '4',
     TARCHIVIST_DIR      =  '5',
     TARCHIVIST_FIFO     =  '6',
-    TARCHIVIST_CONT     =  '7'
+    TARCHIVIST_CONT     =  '7',
+    TARCHIVIST_PAX      =  'x',
+    TARCHIVIST_GLOBAL   =  'g'
+};
+
+/* What happens to the archive data in the page cache once it has been read or written */
+enum tarchivist_cache_policy_e {
+    TARCHIVIST_CACHE_KEEP = 0, /* Left to the system */
+    TARCHIVIST_CACHE_DROP = 1  /* Dropped behind the current position, in batches */
+};
+
+/* How a path given to the matcher is compared with the full paths of the members */
+enum tarchivist_match_kind_e {
+    TARCHIVIST_MATCH_EXACT  = 0,
+    TARCHIVIST_MATCH_PREFIX = 1, /* Any path starting with the given string */
+    TARCHIVIST_MATCH_GLOB   = 2  /* Shell wildcards '*', '?' and '[...]', '*' matches slashes too */
 };
 
 enum tarchivist_seek_origin_e {
@@ -63,26 +82,251 @@ enum tarchivist_seek_origin_e {
     TARCHIVIST_SEEK_END = 1
 };
 
+/* Memory allocator used instead of malloc, e.g. for the index and the listing; sizes are passed back on release */
+typedef struct tarchivist_allocator_t {
+    void *(*alloc) (void *ctx, size_t size);
+    void *(*resize) (void *ctx, void *ptr, size_t old_size, size_t size); /* Contents are kept, just as with realloc */
+    void  (*release) (void *ctx, void *ptr, size_t size);
+    void *ctx;
+} tarchivist_allocator_t;
+
+/* Allocator handing out a single block of memory provided by the caller */
+typedef struct tarchivist_arena_t {
+    tarchivist_allocator_t allocator; /* To be passed to the library */
+    uint8_t *memory;
+    size_t size;
+    size_t used;
+    size_t last; /* Offset of the most recent allocation, the only one that can be resized in place or given back */
+} tarchivist_arena_t;
+
+typedef struct tarchivist_entry_t {
+    const char *path;      /* Full path of the member (prefix + '/' + name) */
+    int64_t header_offset; /* Position of the member's header in the archive (or of its extended header) */
+    int64_t data_offset;   /* Position of the member's data in the archive */
+    uint64_t size;
+    char typeflag;
+} tarchivist_entry_t;
+
+typedef struct tarchivist_index_t {
+    tarchivist_entry_t *entries;
+    unsigned count;
+    unsigned capacity;
+    unsigned *buckets; /* Hash table of entry indices increased by one, 0 marks an empty bucket */
+    unsigned bucket_count;
+    void *pool;        /* Storage for the paths */
+    int64_t end_offset; /* Position right after the last member */
+    const tarchivist_allocator_t *allocator; /* NULL means malloc */
+} tarchivist_index_t;
+
+/* Members of the archive as parallel arrays, for listing huge archives with little memory */
+typedef struct tarchivist_list_t {
+    unsigned count;
+    unsigned capacity;
+    int64_t *header_offsets; /* Arrays share a single allocation */
+    int64_t *data_offsets;
+    uint64_t *sizes;
+    size_t *path_offsets;    /* Position of the member's path in the pool, see tarchivist_list_path */
+    unsigned *mtimes;
+    char *typeflags;
+    char *paths;             /* Pool of the null-terminated paths */
+    size_t paths_size;
+    size_t paths_capacity;
+    const tarchivist_allocator_t *allocator; /* NULL means malloc */
+} tarchivist_list_t;
+
+/* Pre-encoded header for writing a lot of members sharing all fields but name, size and mtime */
+typedef struct tarchivist_template_t {
+    char raw[TARCHIVIST_TAR_BLOCK_SIZE];
+    unsigned checksum;
+} tarchivist_template_t;
+
+/* Piece of the member data for gathered writes */
+typedef struct tarchivist_iovec_t {
+    const void *data;
+    size_t size;
+} tarchivist_iovec_t;
+
+/* Piece of the archive written to memory, allocated together with its data */
+typedef struct tarchivist_mem_chunk_t {
+    struct tarchivist_mem_chunk_t *next;
+    size_t size;     /* Bytes of the archive in the chunk */
+    size_t capacity;
+    uint8_t *data;
+} tarchivist_mem_chunk_t;
+
+/* Archive in memory, see tarchivist_open_mem */
+typedef struct tarchivist_membuf_t {
+    const void *data;             /* Archive to be read, never copied */
+    size_t size;                  /* Size of the archive read or written so far */
+    tarchivist_mem_chunk_t *head; /* Chunks of the written archive, in order */
+    tarchivist_mem_chunk_t *tail;
+    size_t chunk_size;            /* Capacity of the next chunk, doubled for every chunk */
+} tarchivist_membuf_t;
+
+/* Counters of the read-ahead engine */
+typedef struct tarchivist_readahead_stats_t {
+    uint64_t hits;       /* Reads served entirely from the prefetched data */
+    uint64_t misses;     /* Reads that had to go to the stream, at least partially */
+    uint64_t hit_bytes;
+    uint64_t miss_bytes;
+    uint64_t prefetched; /* Members prefetched */
+} tarchivist_readahead_stats_t;
+
 typedef struct tarchivist_t tarchivist_t;
+typedef struct tarchivist_readahead_t tarchivist_readahead_t;
+
+/* Cursor over the archive members, tracking the stream position on its own */
+typedef struct tarchivist_iter_t {
+    tarchivist_t *tar;
+    int64_t pos;         /* Current position of the stream */
+    int64_t header_pos;  /* Position of the current member's header */
+    int64_t data_pos;    /* Position of the current member's data */
+    int64_t next_pos;    /* Position of the next member's header */
+    uint64_t size;       /* Size of the current member's data */
+    uint64_t bytes_left; /* Data of the current member left to read */
+} tarchivist_iter_t;
+
+/* Set of paths and patterns looked up in a single pass by tarchivist_find_batch */
+typedef struct tarchivist_matcher_t {
+    unsigned count;          /* Patterns added so far, patterns are numbered in the order of adding */
+    char **exact;            /* Hash table of the exact paths, NULL marks an empty bucket */
+    unsigned *exact_ids;
+    unsigned exact_count;
+    unsigned bucket_count;
+    void *trie;              /* Prefixes */
+    char **globs;
+    unsigned *glob_ids;
+    unsigned glob_count;
+    unsigned glob_capacity;
+    const tarchivist_allocator_t *allocator; /* NULL means malloc */
+} tarchivist_matcher_t;
+
+/* Member matched by tarchivist_find_batch */
+typedef struct tarchivist_match_t {
+    const char *path;        /* Full path of the member (prefix + '/' + name) */
+    const tarchivist_header_t *header;
+    int64_t header_offset;
+    int64_t data_offset;
+    unsigned pattern;        /* Lowest number of the patterns the member matched */
+    tarchivist_iter_t *iter; /* Data of the member can be read with tarchivist_iter_read_data during the callback */
+} tarchivist_match_t;
+
+/* Called for every member matched, returning anything but TARCHIVIST_SUCCESS stops the search */
+typedef int (*tarchivist_match_callback_t)(void *ctx, const tarchivist_match_t *match);
+
+/* Provides the data of a member produced by the generator: fills 'data' with at most 'size' bytes,
+ * returns the number of bytes provided or negative return code on failure */
+typedef long (*tarchivist_source_t)(void *ctx, void *data, unsigned size);
+
+/* Member queued in the generator */
+typedef struct tarchivist_gen_member_t {
+    struct tarchivist_gen_member_t *next;
+    tarchivist_header_t header;
+    tarchivist_source_t source;
+    void *ctx;
+    int fd;              /* Used if there's no source, owned by the generator */
+} tarchivist_gen_member_t;
+
+/* Archive produced on demand, piece by piece, into the buffers provided by the caller */
+typedef struct tarchivist_gen_t {
+    tarchivist_gen_member_t *head;
+    tarchivist_gen_member_t *tail;
+    tarchivist_gen_member_t *spare; /* Produced members kept for reuse */
+    const tarchivist_allocator_t *allocator; /* NULL means malloc */
+    uint8_t staging[3 * TARCHIVIST_TAR_BLOCK_SIZE]; /* Headers of the current member or the closing record */
+    unsigned staged;     /* Bytes in the staging area */
+    unsigned staged_pos; /* Bytes of the staging area already produced */
+    uint64_t bytes_left; /* Data of the current member left to produce */
+    unsigned pad_left;   /* Padding of the current member left to produce */
+    bool in_member;
+    bool finished;       /* No more members are going to be added */
+    bool closing;        /* Closing record is being produced */
+    bool done;           /* Whole archive has been produced */
+} tarchivist_gen_t;
+
+/* Events of the push parser, returning anything but TARCHIVIST_SUCCESS stops the parsing */
+typedef struct tarchivist_parser_callbacks_t {
+    int (*header) (void *ctx, const tarchivist_header_t *header);
+    int (*data) (void *ctx, const void *data, unsigned size); /* Data points into the fed chunk */
+    int (*member_end) (void *ctx);
+    int (*archive_end) (void *ctx);
+} tarchivist_parser_callbacks_t;
+
+/* Parser fed with the archive in chunks of arbitrary size, as they arrive */
+typedef struct tarchivist_parser_t {
+    tarchivist_parser_callbacks_t callbacks; /* Any of them may be NULL */
+    void *ctx;
+    int state;
+    int err;             /* Error that stopped the parsing */
+    uint8_t block[TARCHIVIST_TAR_BLOCK_SIZE]; /* Header split between the chunks */
+    unsigned block_used;
+    char *pax;           /* Data of the extended header, either in pax_buffer or allocated */
+    char pax_buffer[2 * TARCHIVIST_TAR_BLOCK_SIZE];
+    unsigned pax_size;
+    unsigned pax_used;
+    bool has_pax_size;
+    uint64_t pax_value;  /* Size taken from the extended header */
+    uint64_t bytes_left; /* Data of the current member left to parse */
+    unsigned pad_left;   /* Padding of the current member left to skip */
+    bool done;           /* End of the archive has been reached */
+    const tarchivist_allocator_t *allocator; /* NULL means malloc */
+} tarchivist_parser_t;
 
 struct tarchivist_t {
     /* Pointers to IO functions */
-    int  (*seek) (tarchivist_t *tar, long offset, int whence);
-    long (*tell) (tarchivist_t *tar);
-    int  (*read) (tarchivist_t *tar, unsigned size, void *data);
-    int  (*write) (tarchivist_t *tar, unsigned size, const void *data);
-    int  (*close) (tarchivist_t *tar);
+    int     (*seek) (tarchivist_t *tar, int64_t offset, int whence);
+    int64_t (*tell) (tarchivist_t *tar);
+    int     (*read) (tarchivist_t *tar, unsigned size, void *data);
+    int     (*write) (tarchivist_t *tar, unsigned size, const void *data);
+    int     (*close) (tarchivist_t *tar);
+    int     (*writev) (tarchivist_t *tar, const tarchivist_iovec_t *iov, unsigned iovcnt); /* Optional */
+    int     (*pread) (tarchivist_t *tar, int64_t offset, unsigned size, void *data); /* Optional, must not move the stream */
 
     /* Internal variables */
     void *stream;
     bool finalize;
-    unsigned bytes_left;
-    long last_header_pos;
+    uint64_t bytes_left;
+    int64_t last_header_pos;
+    int64_t last_data_pos;
+    tarchivist_index_t *index;
+    bool owns_index;
+    const tarchivist_entry_t *entry;
+    const void *map; /* Archive image in memory, if available */
+    size_t map_size;
+    int64_t direct_pos;
+    uint8_t *buffer; /* Write-back buffer */
+    unsigned buffer_size;
+    unsigned buffer_used;
+    bool unbuffered;
+    bool sequential; /* Stream can only be read forward, see the 's' modifier */
+    int64_t pos;     /* Position of the stream tracked by the library when writing or reading forward-only */
+    tarchivist_header_t header; /* Header of the current member of the forward-only stream */
+    bool header_valid;
+    tarchivist_readahead_t *readahead; /* Read-ahead engine, if started */
+    int cache_policy;      /* See tarchivist_cache_policy_e */
+    int cache_fd;
+    int64_t cache_dropped; /* Archive before this position has been dropped from the page cache */
+    int64_t cache_flushed; /* Archive between cache_dropped and this position is being written back */
+    const tarchivist_allocator_t *allocator; /* See tarchivist_set_allocator, NULL means malloc */
 };
 
+/* Archive opened once for reading by many threads, with a single descriptor (or mapping) and index */
+typedef struct tarchivist_shared_t {
+    tarchivist_t tar;
+    tarchivist_index_t index; /* Unused if the index trailer was loaded */
+} tarchivist_shared_t;
+
+/* Per-thread cursor over a member of the shared archive */
+typedef struct tarchivist_reader_t {
+    tarchivist_shared_t *shared;
+    const tarchivist_entry_t *entry;
+    uint64_t offset; /* Position within the member's data */
+} tarchivist_reader_t;
+
 int tarchivist_skip_closing_record(tarchivist_t *tar);
 
 int tarchivist_open(tarchivist_t *tar, const char *filename, const char *io_mode);
+int tarchivist_open_mem(tarchivist_t *tar, tarchivist_membuf_t *membuf, const char *io_mode);
 int tarchivist_close(tarchivist_t *tar);
 
 int tarchivist_next(tarchivist_t *tar);
@@ -90,8 +334,66 @@ int tarchivist_find(tarchivist_t *tar, const char *filename, tarchivist_header_t
 
 int tarchivist_read_header(tarchivist_t *tar, tarchivist_header_t *header);
 long tarchivist_read_data(tarchivist_t *tar, unsigned size, void *data);
+int tarchivist_iter_init(tarchivist_t *tar, tarchivist_iter_t *iter);
+int tarchivist_iter_next(tarchivist_iter_t *iter, tarchivist_header_t *header);
+long tarchivist_iter_read_data(tarchivist_iter_t *iter, unsigned size, void *data);
+
+int tarchivist_view_data(tarchivist_t *tar, const void **data, uint64_t *size);
+long tarchivist_pread(tarchivist_t *tar, const tarchivist_entry_t *member, uint64_t offset, unsigned size, void *data);
 int tarchivist_write_header(tarchivist_t *tar, const tarchivist_header_t *header);
 long tarchivist_write_data(tarchivist_t *tar, unsigned size, const void *data);
+int tarchivist_flush(tarchivist_t *tar);
+int tarchivist_set_buffer(tarchivist_t *tar, unsigned size);
+int tarchivist_set_cache_policy(tarchivist_t *tar, int policy);
+int tarchivist_set_allocator(tarchivist_t *tar, const tarchivist_allocator_t *allocator);
+int tarchivist_write_member(tarchivist_t *tar, const tarchivist_header_t *header, const tarchivist_iovec_t *iov, unsigned iovcnt);
+
+int tarchivist_direct_begin(tarchivist_t *tar, int *fd, int64_t *offset, uint64_t *size);
+int tarchivist_direct_end(tarchivist_t *tar, uint64_t size);
+
+int tarchivist_readahead_start(tarchivist_t *tar, unsigned depth, size_t budget);
+int tarchivist_readahead_stats(const tarchivist_t *tar, tarchivist_readahead_stats_t *stats);
+int tarchivist_readahead_stop(tarchivist_t *tar);
+
+int tarchivist_template_init(tarchivist_template_t *tpl, const tarchivist_header_t *header);
+int tarchivist_write_header_template(tarchivist_t *tar, const tarchivist_template_t *tpl, const char *name, uint64_t size, unsigned mtime);
+
+int tarchivist_gen_init(tarchivist_gen_t *gen, const tarchivist_allocator_t *allocator);
+int tarchivist_gen_add(tarchivist_gen_t *gen, const tarchivist_header_t *header, tarchivist_source_t source, void *ctx);
+int tarchivist_gen_add_fd(tarchivist_gen_t *gen, const tarchivist_header_t *header, int fd);
+int tarchivist_gen_finish(tarchivist_gen_t *gen);
+long tarchivist_gen_fill(tarchivist_gen_t *gen, void *buffer, unsigned size);
+void tarchivist_gen_free(tarchivist_gen_t *gen);
+
+int tarchivist_parser_init(tarchivist_parser_t *parser, const tarchivist_parser_callbacks_t *callbacks, void *ctx, const tarchivist_allocator_t *allocator);
+int tarchivist_parser_feed(tarchivist_parser_t *parser, const void *data, unsigned size);
+void tarchivist_parser_free(tarchivist_parser_t *parser);
+
+int tarchivist_index_build(tarchivist_t *tar, tarchivist_index_t *index);
+const tarchivist_entry_t *tarchivist_index_lookup(const tarchivist_index_t *index, const char *path);
+void tarchivist_index_free(tarchivist_index_t *index);
+
+int tarchivist_arena_init(tarchivist_arena_t *arena, void *memory, size_t size);
+void tarchivist_arena_reset(tarchivist_arena_t *arena);
+
+int tarchivist_membuf_init(tarchivist_membuf_t *membuf, const void *data, size_t size);
+tarchivist_mem_chunk_t *tarchivist_membuf_release(tarchivist_membuf_t *membuf);
+void tarchivist_membuf_free(tarchivist_membuf_t *membuf);
+
+int tarchivist_shared_open(tarchivist_shared_t *shared, const char *filename, const char *io_mode);
+int tarchivist_shared_close(tarchivist_shared_t *shared);
+int tarchivist_reader_open(tarchivist_reader_t *reader, tarchivist_shared_t *shared, const char *path);
+long tarchivist_reader_read(tarchivist_reader_t *reader, unsigned size, void *data);
+int tarchivist_reader_view(tarchivist_reader_t *reader, const void **data, uint64_t *size);
+
+int tarchivist_list_build(tarchivist_t *tar, tarchivist_list_t *list);
+const char *tarchivist_list_path(const tarchivist_list_t *list, unsigned i);
+void tarchivist_list_free(tarchivist_list_t *list);
+
+int tarchivist_matcher_init(tarchivist_matcher_t *matcher, const tarchivist_allocator_t *allocator);
+int tarchivist_matcher_add(tarchivist_matcher_t *matcher, const char *pattern, int kind);
+void tarchivist_matcher_free(tarchivist_matcher_t *matcher);
+int tarchivist_find_batch(tarchivist_t *tar, const tarchivist_matcher_t *matcher, tarchivist_match_callback_t callback, void *ctx);
 
 const char *tarchivist_strerror(int error_code);
 
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2022 Lefucjusz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "../../tarchivist.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#define ARCHIVE_SIZE (64 * 1024)
+
+typedef struct mem_stream_t {
+    uint8_t data[ARCHIVE_SIZE];
+    size_t size;
+    size_t pos;
+    unsigned writev_calls;
+} mem_stream_t;
+
+/* Memory stream callbacks */
+static int mem_seek(tarchivist_t *tar, int64_t offset, int whence) {
+    mem_stream_t *mem = tar->stream;
+    const int64_t pos = (whence == TARCHIVIST_SEEK_END) ? (int64_t)mem->size + offset : offset;
+    if (pos < 0 || (size_t)pos > mem->size) {
+        return TARCHIVIST_SEEKFAIL;
+    }
+    mem->pos = pos;
+    return TARCHIVIST_SUCCESS;
+}
+
+static int64_t mem_tell(tarchivist_t *tar) {
+    const mem_stream_t *mem = tar->stream;
+    return mem->pos;
+}
+
+static int mem_read(tarchivist_t *tar, unsigned size, void *data) {
+    mem_stream_t *mem = tar->stream;
+    if (mem->size - mem->pos < size) {
+        return TARCHIVIST_READFAIL;
+    }
+    memcpy(data, mem->data + mem->pos, size);
+    mem->pos += size;
+    return TARCHIVIST_SUCCESS;
+}
+
+static int mem_write(tarchivist_t *tar, unsigned size, const void *data) {
+    mem_stream_t *mem = tar->stream;
+    if (sizeof(mem->data) - mem->pos < size) {
+        return TARCHIVIST_WRITEFAIL;
+    }
+    memcpy(mem->data + mem->pos, data, size);
+    mem->pos += size;
+    if (mem->pos > mem->size) {
+        mem->size = mem->pos;
+    }
+    return TARCHIVIST_SUCCESS;
+}
+
+static int mem_writev(tarchivist_t *tar, const tarchivist_iovec_t *iov, unsigned iovcnt) {
+    mem_stream_t *mem = tar->stream;
+    unsigned i;
+    int err;
+
+    mem->writev_calls++;
+    for (i = 0; i < iovcnt; ++i) {
+        err = mem_write(tar, (unsigned)iov[i].size, iov[i].data);
+        if (err != TARCHIVIST_SUCCESS) {
+            return err;
+        }
+    }
+    return TARCHIVIST_SUCCESS;
+}
+
+static int mem_close(tarchivist_t *tar) {
+    (void)tar;
+    return TARCHIVIST_SUCCESS;
+}
+
+static void mem_tar_init(tarchivist_t *tar, mem_stream_t *mem) {
+    memset(tar, 0, sizeof(tarchivist_t));
+    tar->seek = mem_seek;
+    tar->tell = mem_tell;
+    tar->read = mem_read;
+    tar->write = mem_write;
+    tar->writev = mem_writev;
+    tar->close = mem_close;
+    tar->stream = mem;
+}
+
+static int check_member(tarchivist_t *tar, const char *path, const char *content) {
+    tarchivist_header_t header;
+    char buffer[64];
+    int err;
+
+    err = tarchivist_find(tar, path, &header);
+    if (err != TARCHIVIST_SUCCESS) {
+        return err;
+    }
+    if (header.size != strlen(content) || tarchivist_read_data(tar, sizeof(buffer), buffer) != (int)header.size) {
+        return TARCHIVIST_READFAIL;
+    }
+    return (memcmp(buffer, content, header.size) == 0) ? TARCHIVIST_SUCCESS : TARCHIVIST_READFAIL;
+}
+
+/* Member written with tarchivist_write_member goes to the writev callback even though the
+ * write-back buffer is enabled by default, along with the data buffered before it */
+int main(void) {
+    static mem_stream_t mem;
+    static const char first[] = "written through the write-back buffer";
+    static const char second_head[] = "written ";
+    static const char second_tail[] = "with writev";
+    const tarchivist_iovec_t iov[] = {{second_head, sizeof(second_head) - 1}, {second_tail, sizeof(second_tail) - 1}};
+    tarchivist_header_t header = {0};
+    tarchivist_t tar;
+    int err;
+
+    mem_tar_init(&tar, &mem);
+    tar.finalize = true;
+
+    header.mode = 0644;
+    header.typeflag = TARCHIVIST_FILE;
+    strcpy(header.name, "first.txt");
+    header.size = sizeof(first) - 1;
+    err = tarchivist_write_header(&tar, &header);
+    if (err == TARCHIVIST_SUCCESS) {
+        err = (tarchivist_write_data(&tar, header.size, first) == (int)header.size) ? TARCHIVIST_SUCCESS : TARCHIVIST_WRITEFAIL;
+    }
+    if (err == TARCHIVIST_SUCCESS) {
+        strcpy(header.name, "second.txt");
+        err = tarchivist_write_member(&tar, &header, iov, 2);
+    }
+    if (err == TARCHIVIST_SUCCESS) {
+        err = tarchivist_close(&tar);
+    }
+    if (err != TARCHIVIST_SUCCESS) {
+        printf("Writing failed: %d\n", err);
+        return 1;
+    }
+    if (mem.writev_calls == 0) {
+        printf("writev callback has not been called\n");
+        return 1;
+    }
+
+    mem_tar_init(&tar, &mem);
+    err = check_member(&tar, "first.txt", first);
+    if (err == TARCHIVIST_SUCCESS) {
+        err = check_member(&tar, "second.txt", "written with writev");
+    }
+    if (err != TARCHIVIST_SUCCESS) {
+        printf("Reading back failed: %d\n", err);
+        return 1;
+    }
+
+    printf("writev: %u calls, archive of %zu bytes read back correctly\n", mem.writev_calls, mem.size);
+    return 0;
+}